@@ -58,9 +58,63 @@ pub fn build(b: *std.Build) void {
     const c_test_colors_step = b.step("c-test-colors", "Run C test colors");
     c_test_colors_step.dependOn(&c_test_colors_run.step);
 
-    inline for ([_]*std.Build.Step.Compile{ wrapper_test, c_example, c_test_colors }) |c| {
+    var c_bench_history = b.addExecutable(.{
+        .name = "c-bench-history",
+        .target = target,
+        .optimize = optimize,
+    });
+    c_bench_history.root_module.addCSourceFile(.{ .file = b.path("test/bench_history.c") });
+
+    var c_bench_history_run = b.addRunArtifact(c_bench_history);
+
+    const c_bench_history_step = b.step("c-bench-history", "Run C history benchmark");
+    c_bench_history_step.dependOn(&c_bench_history_run.step);
+
+    var c_bench_completions = b.addExecutable(.{
+        .name = "c-bench-completions",
+        .target = target,
+        .optimize = optimize,
+    });
+    c_bench_completions.root_module.addCSourceFile(.{ .file = b.path("test/bench_completions.c") });
+
+    var c_bench_completions_run = b.addRunArtifact(c_bench_completions);
+
+    const c_bench_completions_step = b.step("c-bench-completions", "Run C completions benchmark");
+    c_bench_completions_step.dependOn(&c_bench_completions_run.step);
+
+    var c_bench_fuzzy = b.addExecutable(.{
+        .name = "c-bench-fuzzy",
+        .target = target,
+        .optimize = optimize,
+    });
+    c_bench_fuzzy.root_module.addCSourceFile(.{ .file = b.path("test/bench_fuzzy.c") });
+
+    var c_bench_fuzzy_run = b.addRunArtifact(c_bench_fuzzy);
+
+    const c_bench_fuzzy_step = b.step("c-bench-fuzzy", "Run C fuzzy completion benchmark");
+    c_bench_fuzzy_step.dependOn(&c_bench_fuzzy_run.step);
+
+    var c_bench_refresh = b.addExecutable(.{
+        .name = "c-bench-refresh",
+        .target = target,
+        .optimize = optimize,
+    });
+    c_bench_refresh.root_module.addCSourceFile(.{ .file = b.path("test/bench_refresh.c") });
+
+    var c_bench_refresh_run = b.addRunArtifact(c_bench_refresh);
+
+    const c_bench_refresh_step = b.step("c-bench-refresh", "Run C refresh benchmark (and check the incremental refresh)");
+    c_bench_refresh_step.dependOn(&c_bench_refresh_run.step);
+
+    inline for ([_]*std.Build.Step.Compile{ wrapper_test, c_example, c_test_colors, c_bench_history }) |c| {
         c.linkLibC();
         c.addIncludePath(b.path("include"));
         c.root_module.addCSourceFile(.{ .file = b.path("src/isocline.c") });
     }
+
+    // these benchmarks include `src/isocline.c` themselves to use the internal functions
+    inline for ([_]*std.Build.Step.Compile{ c_bench_completions, c_bench_fuzzy, c_bench_refresh }) |c| {
+        c.linkLibC();
+        c.addIncludePath(b.path("include"));
+    }
 }
@@ -128,6 +128,7 @@ void ic_style_close(void);
 
 /// Enable history. 
 /// Use a \a NULL filename to not persist the history. Use -1 for max_entries to get the default (200).
+/// There is no upper limit on `max_entries`; memory use is proportional to the actual number of entries.
 void ic_set_history(const char* fname, long max_entries );
 
 /// Remove the last entry in the history. 
@@ -140,6 +141,20 @@ void ic_history_clear(void);
 /// Add an entry to the history
 void ic_history_add( const char* entry );
 
+/// Attach metadata to the latest history entry, usually the input just returned by ic_readline().
+/// Use \a duration_ms for the time it took to run the input, \a status for a 
+/// status code (like an exit code), and \a cwd for the working directory (or NULL).
+/// The time an entry is accepted by ic_readline() is recorded automatically.
+/// Metadata is saved in the history file on comment lines that older versions ignore.
+/// Returns false if the history is empty.
+bool ic_history_set_meta( long duration_ms, int status, const char* cwd );
+
+/// Get the metadata of the \a n'th latest history entry (0 for the latest).
+/// The \a time is in seconds since the epoch (or 0 if unknown), and \a cwd is NULL if unknown.
+/// Any of the output parameters can be NULL. 
+/// Returns the entry itself, or NULL if there is no such entry.
+const char* ic_history_get_meta( long n, int64_t* time, long* duration_ms, int* status, const char** cwd );
+
 /// \}
 
 //--------------------------------------------------------------
@@ -188,6 +203,23 @@ bool ic_add_completion(ic_completion_env_t* cenv, const char* completion);
 /// If `false` is returned, the callback should try to return and not add more completions (for improved latency).
 bool ic_add_completion_ex( ic_completion_env_t* cenv, const char* completion, const char* display, const char* help );
 
+/// A completion as added by `ic_add_completions_n`.
+typedef struct ic_completion_s {
+  const char* replacement;  ///< the completion (elements with a NULL replacement are skipped)
+  const char* display;      ///< displayed in the completion menu (or NULL for the default)
+  const char* help;         ///< help text (or NULL)
+} ic_completion_t;
+
+/// In a completion callback (usually from ic_complete_word()), use this function to add
+/// `count` completions at once. This is equivalent to calling `ic_add_completion_ex` on each
+/// element but much faster for large numbers of completions, as the completions are stored
+/// with a single allocation (and, for asynchronous completers, a single lock).
+/// (all strings are copied by isocline and do not need to be preserved or allocated).
+///
+/// Returns `true` if the callback should continue trying to find more possible completions.
+/// If `false` is returned, the callback should try to return and not add more completions (for improved latency).
+bool ic_add_completions_n(ic_completion_env_t* cenv, const ic_completion_t* completions, long count);
+
 /// In a completion callback (usually from ic_complete_word()), use this function to add completions.
 /// The `completions` array should be terminated with a NULL element, and all elements
 /// are added as completions if they start with `prefix`.
@@ -196,6 +228,38 @@ bool ic_add_completion_ex( ic_completion_env_t* cenv, const char* completion, co
 /// If `false` is returned, the callback should try to return and not add more completions (for improved latency).
 bool ic_add_completions(ic_completion_env_t* cenv, const char* prefix, const char** completions);
 
+/// In a completion callback (usually from ic_complete_word()), use this function to add fuzzy completions.
+/// The `completions` array should be terminated with a NULL element, and the elements that
+/// contain the characters of `prefix` in order are added, best match first. Matches score higher
+/// when the characters are consecutive or start a word (like the `B` in `fooBar` or `foo_bar`). 
+/// Case is ignored unless `prefix` contains an upper case character.
+/// Only as many completions as can be shown are added, and the completion menu keeps them in 
+/// score order instead of sorting them.
+///
+/// Returns `true` if the callback should continue trying to find more possible completions.
+/// If `false` is returned, the callback should try to return and not add more completions (for improved latency).
+bool ic_add_completions_fuzzy(ic_completion_env_t* cenv, const char* prefix, const char** completions);
+
+/// A compiled list of words for fast completion (see `ic_wordlist_new`).
+typedef struct ic_wordlist_s ic_wordlist_t;
+
+/// Compile a NULL terminated array of words for completion with `ic_add_completions_wordlist`.
+/// The words are copied and sorted once (ignoring case) such that completing a prefix takes 
+/// logarithmic time in the number of words (instead of scanning all words like `ic_add_completions`).
+/// The word list is immutable and can be shared between completers, environments, and threads.
+/// Returns NULL if out of memory. Free it with `ic_wordlist_free`.
+ic_wordlist_t* ic_wordlist_new(const char** words);
+
+/// Free a word list.
+void ic_wordlist_free(ic_wordlist_t* wordlist);
+
+/// In a completion callback (usually from ic_complete_word()), use this function to add 
+/// all words in `wordlist` that start with `prefix` (ignoring case) as completions.
+///
+/// Returns `true` if the callback should continue trying to find more possible completions.
+/// If `false` is returned, the callback should try to return and not add more completions (for improved latency).
+bool ic_add_completions_wordlist(ic_completion_env_t* cenv, const char* prefix, const ic_wordlist_t* wordlist);
+
 /// Complete a filename.
 /// Complete a filename given a semi-colon separated list of root directories `roots` and 
 /// semi-colon separated list of possible extensions (excluding directories). 
@@ -210,6 +274,8 @@ bool ic_add_completions(ic_completion_env_t* cenv, const char* prefix, const cha
 /// /home/.ba   --> /home/.bashrc
 /// ```
 /// (This already uses ic_complete_quoted_word() so do not call it from inside a word handler).
+/// The listings of recently completed directories are cached and only read again
+/// once the modification time of the directory changes.
 void ic_complete_filename( ic_completion_env_t* cenv, const char* prefix, char dir_separator, const char* roots, const char* extensions );
 
 
@@ -347,6 +413,30 @@ bool ic_enable_color( bool enable );
 /// Returns the previous setting.
 bool ic_enable_history_duplicates( bool enable );
 
+/// Disable or enable journaling of the history file (disabled by default).
+/// When enabled, each accepted input is appended to the history file with a single write
+/// instead of rewriting the whole file. The file is only rewritten (compacted) once it 
+/// holds more than twice the number of history entries.
+/// Returns the previous setting.
+bool ic_enable_history_journal( bool enable );
+
+/// Disable or enable syncing the history file to disk after each write (disabled by default).
+/// Use this with ic_enable_history_journal() to not lose any input on a crash.
+/// Returns the previous setting.
+bool ic_enable_history_sync( bool enable );
+
+/// Disable or enable sharing the history file between processes (disabled by default).
+/// New entries are then appended to the file under an advisory lock, and entries
+/// appended by other processes are merged in at the start of each ic_readline().
+/// Returns the previous setting.
+bool ic_enable_history_shared( bool enable );
+
+/// Disable or enable prefix history navigation (disabled by default).
+/// When enabled, the up and down keys only visit history entries that
+/// start with the input typed so far (and visit all entries if the input is empty).
+/// Returns the previous setting.
+bool ic_enable_history_prefix( bool enable );
+
 /// Disable or enable automatic tab completion after a completion 
 /// to expand as far as possible if the completions are unique. (disabled by default).
 /// Returns the previous setting.
@@ -361,6 +451,13 @@ bool ic_enable_completion_preview( bool enable );
 /// Returns the previous setting.
 bool ic_enable_multiline_indent(bool enable);
 
+/// Disable or enable incremental refresh (enabled by default).
+/// When enabled, each refresh of the input only writes the characters
+/// that changed since the previous refresh instead of redrawing every row.
+/// Disable this if the terminal does not handle relative cursor movement well.
+/// Returns the previous setting.
+bool ic_enable_incremental_refresh(bool enable);
+
 /// Disable or enable display of short help messages for history search etc.
 /// (full help is always dispayed when pressing F1 regardless of this setting)
 /// @returns the previous setting.
@@ -371,9 +468,53 @@ bool ic_enable_inline_help(bool enable);
 /// @returns the previous setting.
 bool ic_enable_hint(bool enable);
 
+/// Disable or enable hinting with the history (disabled by default)
+/// If there is no completion hint, shows the rest of the history entry that starts 
+/// with the input and was used most frequently and recently (where a use counts half
+/// after a week) as a hint. Use right-cursor or end to accept it.
+/// @returns the previous setting.
+bool ic_enable_history_hint(bool enable);
+
 /// Set millisecond delay before a hint is displayed. Can be zero. (500ms by default).
 long ic_set_hint_delay(long delay_ms);
 
+/// Disable or enable asynchronous completion (disabled by default).
+/// When enabled, the completer runs on a background thread and its completions
+/// are shown as they arrive while the input stays responsive. Pressing a key 
+/// cancels the completer: `ic_stop_completing` then returns `true`.
+/// The completer must be thread-safe with respect to the main program.
+/// It never runs on two threads at once: a new completion first waits for a cancelled
+/// completer to return, so a completer should check `ic_stop_completing` regularly.
+/// Has no effect if isocline is compiled with `IC_NO_THREADS`.
+/// @returns the previous setting.
+bool ic_enable_async_completion(bool enable);
+
+/// Set the millisecond deadline for an asynchronous completer (1000ms by default).
+/// After the deadline the completer is cancelled and the completions that 
+/// arrived so far are shown. Use zero for no deadline.
+/// @returns the previous setting.
+long ic_set_completion_deadline(long deadline_ms);
+
+/// Disable or enable listing the roots of `ic_complete_filename` in parallel (disabled by default).
+/// When enabled, the root directories (like the directories in a `PATH`) are read on
+/// a few helper threads. The completions are the same as when done sequentially:
+/// they are added in the order of the roots, and a file name found in an
+/// earlier root hides the same name in later ones.
+/// Has no effect if isocline is compiled with `IC_NO_THREADS`.
+/// @returns the previous setting.
+bool ic_enable_parallel_filename_completion(bool enable);
+
+/// Disable or enable caching the directory listings used by `ic_complete_filename` (enabled by default).
+/// A cached listing is reused as long as the directory is not modified.
+/// Disabling the cache drops all cached listings; so disabling and enabling it again clears the cache.
+/// @returns the previous setting.
+bool ic_enable_dircache(bool enable);
+
+/// Set the number of directories whose listings are cached (32 by default, at least 1).
+/// Use a larger size if `ic_complete_filename` is used with more roots than that.
+/// @returns the previous setting.
+long ic_set_dircache_size(long max_dirs);
+
 /// Disable or enable syntax highlighting (enabled by default).
 /// This applies regardless whether a syntax highlighter callback was set (`ic_set_highlighter`)
 /// Returns the previous setting.
@@ -421,8 +562,20 @@ void* ic_completion_arg( const ic_completion_env_t* cenv );
 bool ic_has_completions( const ic_completion_env_t* cenv );
 
 /// Do we already have enough completions and should we return if possible? (for improved latency)
+/// Also returns `true` when an asynchronous completion was cancelled.
 bool ic_stop_completing( const ic_completion_env_t* cenv);
 
+/// Declare that the completions of this call are monotone: the completions for a longer 
+/// input (typed at the cursor) are exactly those completions whose replacement starts with 
+/// the (longer) input they replace (ignoring case). Isocline then refines these completions 
+/// as the user types instead of calling the completer again for every keystroke.
+/// As refinement needs all completions, ic_add_completion() keeps returning `true` for longer after this call.
+void ic_set_monotone_completions( ic_completion_env_t* cenv );
+
+/// Discard any completions that are kept for refinement; use this when the data of
+/// a monotone completer changed.
+void ic_invalidate_completions(void);
+
 
 /// Primitive completion, cannot be used with most transformers (like `ic_complete_word` and `ic_complete_qword`).
 /// When completed, `delete_before` _bytes_ are deleted before the cursor position,
@@ -9,6 +9,14 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#if !defined(IC_NO_THREADS)
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 #include "common.h"
 
 
@@ -146,6 +154,35 @@ static const char* ic_stristr(const char* s, const char* pat) {
   return NULL;
 }
 
+// Hash of the first `n` bytes of a string (used for hash indices).
+// Processes a word at a time; the result is only used in memory.
+ic_private uint32_t ic_strnhash(const char* s, ssize_t n) {
+  const uint64_t k = 0xBF58476D1CE4E5B9ULL;
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)n;
+  if (s == NULL || n <= 0) return (uint32_t)(h ^ (h >> 32));
+  while (n >= 8) {
+    uint64_t w;
+    memcpy(&w, s, 8);
+    h = (h ^ w) * k;
+    h ^= (h >> 31);
+    s += 8;
+    n -= 8;
+  }
+  if (n > 0) {
+    uint64_t w = 0;
+    memcpy(&w, s, to_size_t(n));
+    h = (h ^ w) * k;
+    h ^= (h >> 31);
+  }
+  h *= 0x94D049BB133111EBULL;
+  h ^= (h >> 29);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+ic_private uint32_t ic_strhash(const char* s) {
+  return ic_strnhash(s, ic_strlen(s));
+}
+
 ic_private bool ic_contains(const char* big, const char* s) {
   if (big == NULL) return false;
   if (s == NULL) return true;
@@ -345,3 +382,199 @@ ic_private char* mem_strndup(alloc_t* mem, const char* s, ssize_t n) {
   return p;
 }
 
+
+
+//-------------------------------------------------------------
+// Arena
+//-------------------------------------------------------------
+
+#define IC_ARENA_BLOCK  (64*1024 - 64)
+
+typedef struct arena_block_s {
+  struct arena_block_s* next;
+  ssize_t size;         // available bytes in `data`
+  ssize_t used;         
+  char    data[1];
+} arena_block_t;
+
+struct arena_s {
+  alloc_t*       mem;
+  arena_block_t* blocks;   // all blocks (in allocation order)
+  arena_block_t* current;  // block we currently allocate from
+  ssize_t        used;     // total bytes allocated since the last reset
+};
+
+ic_private arena_t* arena_new(alloc_t* mem) {
+  arena_t* arena = mem_zalloc_tp(mem, arena_t);
+  if (arena == NULL) return NULL;
+  arena->mem = mem;
+  return arena;
+}
+
+ic_private void arena_free(arena_t* arena) {
+  if (arena == NULL) return;
+  arena_block_t* b = arena->blocks;
+  while (b != NULL) {
+    arena_block_t* next = b->next;
+    mem_free(arena->mem, b);
+    b = next;
+  }
+  mem_free(arena->mem, arena);
+}
+
+ic_private void arena_reset(arena_t* arena) {
+  if (arena == NULL) return;
+  for (arena_block_t* b = arena->blocks; b != NULL; b = b->next) {
+    b->used = 0;
+  }
+  arena->current = arena->blocks;
+  arena->used = 0;
+}
+
+ic_private ssize_t arena_used(const arena_t* arena) {
+  return (arena == NULL ? 0 : arena->used);
+}
+
+static void* arena_alloc(arena_t* arena, ssize_t size) {
+  arena_block_t* b = arena->current;
+  // try the current block and any (reset) blocks after it
+  while (b != NULL && b->size - b->used < size) {
+    b = b->next;
+  }
+  if (b == NULL) {
+    // allocate a fresh block after the current one
+    const ssize_t bsize = (size > IC_ARENA_BLOCK ? size : IC_ARENA_BLOCK);
+    b = (arena_block_t*)mem_malloc(arena->mem, ssizeof(arena_block_t) + bsize);
+    if (b == NULL) return NULL;
+    b->size = bsize;
+    b->used = 0;
+    if (arena->current == NULL) {
+      b->next = arena->blocks;
+      arena->blocks = b;
+    }
+    else {
+      b->next = arena->current->next;
+      arena->current->next = b;
+    }
+  }
+  arena->current = b;
+  void* p = b->data + b->used;
+  b->used += size;
+  arena->used += size;
+  return p;
+}
+
+ic_private char* arena_strndup(arena_t* arena, const char* s, ssize_t n) {
+  if (arena == NULL || s == NULL || n < 0) return NULL;
+  char* p = (char*)arena_alloc(arena, n+1);
+  if (p == NULL) return NULL;
+  ic_memcpy(p, s, n);
+  p[n] = 0;
+  return p;
+}
+
+ic_private char* arena_strdup(arena_t* arena, const char* s) {
+  if (s == NULL) return NULL;
+  return arena_strndup(arena, s, ic_strlen(s));
+}
+
+
+//-------------------------------------------------------------
+// Threads
+// With `IC_NO_THREADS` no thread can be started and locks do nothing.
+//-------------------------------------------------------------
+
+#if defined(IC_NO_THREADS)
+
+ic_private ic_mutex_t* mutex_new(alloc_t* mem) { ic_unused(mem); return NULL; }
+ic_private void mutex_free(alloc_t* mem, ic_mutex_t* m) { ic_unused(mem); ic_unused(m); }
+ic_private void mutex_lock(ic_mutex_t* m) { ic_unused(m); }
+ic_private void mutex_unlock(ic_mutex_t* m) { ic_unused(m); }
+
+ic_private ic_thread_t* thread_start(alloc_t* mem, ic_thread_fun_t* fun, void* arg) {
+  ic_unused(mem); ic_unused(fun); ic_unused(arg);
+  return NULL;
+}
+ic_private void thread_join(alloc_t* mem, ic_thread_t* t) { ic_unused(mem); ic_unused(t); }
+
+#else
+
+#if defined(_WIN32)
+struct ic_mutex_s { CRITICAL_SECTION cs; };
+struct ic_thread_s { HANDLE handle; ic_thread_fun_t* fun; void* arg; };
+
+ic_private ic_mutex_t* mutex_new(alloc_t* mem) {
+  ic_mutex_t* m = mem_zalloc_tp(mem, ic_mutex_t);
+  if (m != NULL) { InitializeCriticalSection(&m->cs); }
+  return m;
+}
+ic_private void mutex_free(alloc_t* mem, ic_mutex_t* m) {
+  if (m == NULL) return;
+  DeleteCriticalSection(&m->cs);
+  mem_free(mem, m);
+}
+ic_private void mutex_lock(ic_mutex_t* m)   { if (m != NULL) { EnterCriticalSection(&m->cs); } }
+ic_private void mutex_unlock(ic_mutex_t* m) { if (m != NULL) { LeaveCriticalSection(&m->cs); } }
+
+static unsigned __stdcall thread_entry( void* arg ) {
+  ic_thread_t* t = (ic_thread_t*)arg;
+  (*t->fun)(t->arg);
+  return 0;
+}
+ic_private ic_thread_t* thread_start(alloc_t* mem, ic_thread_fun_t* fun, void* arg) {
+  ic_thread_t* t = mem_zalloc_tp(mem, ic_thread_t);
+  if (t == NULL) return NULL;
+  t->fun = fun;
+  t->arg = arg;
+  t->handle = (HANDLE)_beginthreadex(NULL, 0, &thread_entry, t, 0, NULL);
+  if (t->handle == 0) { mem_free(mem, t); return NULL; }
+  return t;
+}
+ic_private void thread_join(alloc_t* mem, ic_thread_t* t) {
+  if (t == NULL) return;
+  WaitForSingleObject(t->handle, INFINITE);
+  CloseHandle(t->handle);
+  mem_free(mem, t);
+}
+
+#else
+struct ic_mutex_s { pthread_mutex_t mutex; };
+struct ic_thread_s { pthread_t thread; ic_thread_fun_t* fun; void* arg; };
+
+ic_private ic_mutex_t* mutex_new(alloc_t* mem) {
+  ic_mutex_t* m = mem_zalloc_tp(mem, ic_mutex_t);
+  if (m != NULL && pthread_mutex_init(&m->mutex, NULL) != 0) {
+    mem_free(mem, m);
+    return NULL;
+  }
+  return m;
+}
+ic_private void mutex_free(alloc_t* mem, ic_mutex_t* m) {
+  if (m == NULL) return;
+  pthread_mutex_destroy(&m->mutex);
+  mem_free(mem, m);
+}
+ic_private void mutex_lock(ic_mutex_t* m)   { if (m != NULL) { pthread_mutex_lock(&m->mutex); } }
+ic_private void mutex_unlock(ic_mutex_t* m) { if (m != NULL) { pthread_mutex_unlock(&m->mutex); } }
+
+static void* thread_entry( void* arg ) {
+  ic_thread_t* t = (ic_thread_t*)arg;
+  (*t->fun)(t->arg);
+  return NULL;
+}
+ic_private ic_thread_t* thread_start(alloc_t* mem, ic_thread_fun_t* fun, void* arg) {
+  ic_thread_t* t = mem_zalloc_tp(mem, ic_thread_t);
+  if (t == NULL) return NULL;
+  t->fun = fun;
+  t->arg = arg;
+  if (pthread_create(&t->thread, NULL, &thread_entry, t) != 0) { mem_free(mem, t); return NULL; }
+  return t;
+}
+ic_private void thread_join(alloc_t* mem, ic_thread_t* t) {
+  if (t == NULL) return;
+  pthread_join(t->thread, NULL);
+  mem_free(mem, t);
+}
+#endif
+
+#endif
@@ -75,6 +75,8 @@ ic_private char ic_tolower(char c);
 ic_private void ic_str_tolower(char *s);
 ic_private int ic_stricmp(const char *s1, const char *s2);
 ic_private int ic_strnicmp(const char *s1, const char *s2, ssize_t n);
+ic_private uint32_t ic_strhash(const char *s);
+ic_private uint32_t ic_strnhash(const char *s, ssize_t n);
 
 //---------------------------------------------------------------------
 // Unicode
@@ -187,4 +189,37 @@ ic_private char *mem_strndup(alloc_t *mem, const char *s, ssize_t n);
 #define mem_realloc_tp(mem, tp, p, n)                                          \
   (tp *)mem_realloc(mem, p, (n) * ssizeof(tp))
 
+//-------------------------------------------------------------
+// Arena: strings are bump allocated in large blocks and
+// released all at once
+//-------------------------------------------------------------
+
+struct arena_s;
+typedef struct arena_s arena_t;
+
+ic_private arena_t *arena_new(alloc_t *mem);
+ic_private void arena_free(arena_t *arena);
+ic_private void arena_reset(arena_t *arena); // keeps the blocks for reuse
+ic_private ssize_t arena_used(const arena_t *arena);
+ic_private char *arena_strdup(arena_t *arena, const char *s);
+ic_private char *arena_strndup(arena_t *arena, const char *s, ssize_t n);
+
+//-------------------------------------------------------------
+// Threads and locks (unless `IC_NO_THREADS` is defined)
+//-------------------------------------------------------------
+
+struct ic_mutex_s;
+typedef struct ic_mutex_s ic_mutex_t;
+struct ic_thread_s;
+typedef struct ic_thread_s ic_thread_t;
+typedef void(ic_thread_fun_t)(void *arg);
+
+ic_private ic_mutex_t *mutex_new(alloc_t *mem); // NULL if there are no threads
+ic_private void mutex_free(alloc_t *mem, ic_mutex_t *m);
+ic_private void mutex_lock(ic_mutex_t *m); // no-op on NULL
+ic_private void mutex_unlock(ic_mutex_t *m);
+ic_private ic_thread_t *thread_start(alloc_t *mem, ic_thread_fun_t *fun,
+                                     void *arg); // NULL if it could not start
+ic_private void thread_join(alloc_t *mem, ic_thread_t *t);
+
 #endif // IC_COMMON_H
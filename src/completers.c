@@ -6,6 +6,7 @@
 -----------------------------------------------------------------------------*/
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "../include/isocline.h"
 #include "common.h"
@@ -24,6 +25,7 @@ typedef struct word_closure_s {
   long                  delete_before_adjust;
   void*                 prev_env;
   ic_completion_fun_t*  prev_complete;
+  ic_completions_fun_t* prev_complete_n;
 } word_closure_t;
 
 
@@ -34,6 +36,11 @@ static bool token_add_completion_ex(ic_env_t* env, void* closure, const char* re
   return (*wenv->prev_complete)(env, wenv->prev_env, replacement, display, help, wenv->delete_before_adjust + delete_before, delete_after);
 }
 
+static bool token_add_completions_n(ic_env_t* env, void* closure, const ic_completion_t* completions, long count, long delete_before, long delete_after) {
+  word_closure_t* wenv = (word_closure_t*)(closure);
+  return (*wenv->prev_complete_n)(env, wenv->prev_env, completions, count, wenv->delete_before_adjust + delete_before, delete_after);
+}
+
 
 ic_public void ic_complete_word(ic_completion_env_t* cenv, const char* prefix, ic_completer_fun_t* fun,
                                     ic_is_char_class_fun_t* is_word_char) 
@@ -60,8 +67,10 @@ ic_public void ic_complete_word(ic_completion_env_t* cenv, const char* prefix, i
   word_closure_t wenv;
   wenv.delete_before_adjust = (long)(len - pos);
   wenv.prev_complete = cenv->complete;
-  wenv.prev_env = cenv->env;
+  wenv.prev_complete_n = cenv->complete_n;
+  wenv.prev_env = cenv->closure;
   cenv->complete = &token_add_completion_ex;
+  cenv->complete_n = (wenv.prev_complete_n != NULL ? &token_add_completions_n : NULL);
   cenv->closure = &wenv;
 
   // and call the user completion routine
@@ -69,6 +78,7 @@ ic_public void ic_complete_word(ic_completion_env_t* cenv, const char* prefix, i
 
   // restore the original environment
   cenv->complete = wenv.prev_complete;
+  cenv->complete_n = wenv.prev_complete_n;
   cenv->closure = wenv.prev_env;
 }
 
@@ -86,6 +96,7 @@ typedef struct qword_closure_s {
   void*        prev_env;
   ic_is_char_class_fun_t* is_word_char;
   ic_completion_fun_t*    prev_complete;
+  ic_completions_fun_t*   prev_complete_n;
 } qword_closure_t;
 
 
@@ -236,10 +247,12 @@ ic_public void ic_complete_qword_ex( ic_completion_env_t* cenv, const char* pref
   wenv.escape_char    = escape_char;
   wenv.delete_before_adjust = (long)(len - pos);
   wenv.prev_complete  = cenv->complete;
-  wenv.prev_env       =  cenv->env;
+  wenv.prev_complete_n = cenv->complete_n;
+  wenv.prev_env       = cenv->closure;
   wenv.sbuf = sbuf_new(cenv->env->mem);
   if (wenv.sbuf == NULL) { mem_free(cenv->env->mem, word); return; }
   cenv->complete = &qword_add_completion_ex;
+  cenv->complete_n = NULL;  // each completion is escaped separately
   cenv->closure = &wenv;
 
   // and call the user completion routine
@@ -247,6 +260,7 @@ ic_public void ic_complete_qword_ex( ic_completion_env_t* cenv, const char* pref
 
   // restore the original environment
   cenv->complete = wenv.prev_complete;
+  cenv->complete_n = wenv.prev_complete_n;
   cenv->closure = wenv.prev_env;
 
   sbuf_free(wenv.sbuf);
@@ -256,6 +270,97 @@ ic_public void ic_complete_qword_ex( ic_completion_env_t* cenv, const char* pref
 
 
 
+//-------------------------------------------------------------
+// Word lists
+// The words are sorted ignoring case so all words that start
+// with a prefix form a range that is found by binary search.
+//-------------------------------------------------------------
+
+struct ic_wordlist_s {
+  alloc_t      mem;     // a copy of the allocator, so the list does not depend on an environment
+  ssize_t      count;
+  const char** words;   // sorted ignoring case (with the characters of all words following the array)
+};
+
+// compare `s` with `t` ignoring case (up to `n` bytes)
+static int wordlist_compare_n(const char* s, const char* t, ssize_t n) {
+  for (ssize_t i = 0; i < n; i++) {
+    const uint8_t c = (uint8_t)ic_tolower(s[i]);
+    const uint8_t d = (uint8_t)ic_tolower(t[i]);
+    if (c != d) return (c < d ? -1 : 1);
+    if (c == 0) return 0;
+  }
+  return 0;
+}
+
+static int wordlist_compare(const void* p1, const void* p2) {
+  const char* s = *((const char**)p1);
+  const char* t = *((const char**)p2);
+  const int cmp = wordlist_compare_n(s, t, PTRDIFF_MAX);
+  return (cmp != 0 ? cmp : strcmp(s, t));  // so duplicates are adjacent
+}
+
+ic_public ic_wordlist_t* ic_wordlist_new(const char** words) {
+  ic_env_t* env = ic_get_env(); if (env == NULL || words == NULL) return NULL;
+  ssize_t count = 0;
+  ssize_t chars = 0;
+  for (const char** pw = words; *pw != NULL; pw++) {
+    count++;
+    chars += ic_strlen(*pw) + 1;
+  }
+  // allocate the list, the array of words, and the characters at once
+  ic_wordlist_t* wl = (ic_wordlist_t*)mem_malloc(env->mem, ssizeof(ic_wordlist_t) + count*ssizeof(const char*) + chars);
+  if (wl == NULL) return NULL;
+  wl->mem = *env->mem;
+  wl->words = (const char**)(wl + 1);
+  ic_memcpy((void*)wl->words, words, count*ssizeof(const char*));
+  qsort((void*)wl->words, to_size_t(count), sizeof(const char*), &wordlist_compare);
+  // copy the words in order and skip duplicates
+  char* p = (char*)(wl->words + count);
+  wl->count = 0;
+  for (ssize_t i = 0; i < count; i++) {
+    const char* w = wl->words[i];
+    if (wl->count > 0 && strcmp(wl->words[wl->count-1], w) == 0) continue;
+    const ssize_t len = ic_strlen(w);
+    ic_memcpy(p, w, len + 1);
+    wl->words[wl->count++] = p;
+    p += len + 1;
+  }
+  return wl;
+}
+
+ic_public void ic_wordlist_free(ic_wordlist_t* wordlist) {
+  if (wordlist == NULL) return;
+  alloc_t mem = wordlist->mem;
+  mem_free(&mem, wordlist);
+}
+
+// the first word that starts with `prefix` or is larger (if `after` is false),
+// or the first word that is larger than all words starting with `prefix` (if `after` is true).
+static ssize_t wordlist_search(const ic_wordlist_t* wl, const char* prefix, ssize_t prefix_len, bool after) {
+  ssize_t lo = 0;
+  ssize_t hi = wl->count;
+  while (lo < hi) {
+    const ssize_t mid = lo + (hi - lo)/2;
+    const int cmp = wordlist_compare_n(wl->words[mid], prefix, prefix_len);
+    if (cmp < 0 || (after && cmp == 0)) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+  return lo;
+}
+
+ic_public bool ic_add_completions_wordlist(ic_completion_env_t* cenv, const char* prefix, const ic_wordlist_t* wordlist) {
+  if (wordlist == NULL) return true;
+  if (prefix == NULL) prefix = "";
+  const ssize_t prefix_len = ic_strlen(prefix);
+  const ssize_t end = wordlist_search(wordlist, prefix, prefix_len, true);
+  for (ssize_t i = wordlist_search(wordlist, prefix, prefix_len, false); i < end; i++) {
+    if (!ic_add_completion_ex(cenv, wordlist->words[i], NULL, NULL)) return false;
+  }
+  return true;
+}
+
+
 //-------------------------------------------------------------
 // Complete file names
 // Listing files
@@ -280,53 +385,114 @@ typedef enum file_type_e {
   FT_LAST
 } file_type_t;
 
-static int         cli_color; // 1 enabled, 0 not initialized, -1 disabled
-static const char* lscolors  = "exfxcxdxbxegedabagacad";  // default BSD setting
-static const char* ls_colors;
-static const char* ls_colors_names[] = { "no=","di=","ln=","so=","pi=","bd=","cd=","su=","sg=","tw=","ow=","st=","ex=", NULL };
-
-static bool ls_colors_init(void) {
-  if (cli_color != 0) return (cli_color >= 1);
-  // colors enabled?
-  const char* s = getenv("CLICOLOR");
-  if (s==NULL || (strcmp(s, "1")!=0 && strcmp(s, "") != 0)) {
-    cli_color = -1;
-    return false;
-  }
-  cli_color = 1;
-  s = getenv("LS_COLORS");
-  if (s != NULL) { ls_colors = s;  }
-  s = getenv("LSCOLORS");
-  if (s != NULL) { lscolors = s; }  
+// LS colors are parsed once into a table with the bbcode to open
+// the color of each file type and of each file extension (`*.ext`).
+typedef struct ls_ext_s {
+  const char* ext;       // extension including the dot
+  const char* bbcode;
+  bool        exact;     // given like this (instead of as the lower case of another)
+} ls_ext_t;
+
+typedef struct ls_colors_s {
+  alloc_t*     mem;
+  arena_t*     strings;
+  const char*  types[FT_LAST];   // bbcode for each file type (or NULL)
+  ls_ext_t*    exts;             // hash map of extensions
+  ssize_t      exts_size;        // 0 or a power of 2
+  ssize_t      exts_count;
+} ls_colors_t;
+
+#define IC_LS_MAX_EXT  (32)    // longer extensions are not colored
+
+static const char* ls_colors_names[] = { "no","di","ln","so","pi","bd","cd","su","sg","tw","ow","st","ex", NULL };
+
+// copy an extension (starting at the dot) into `buf`; returns false if it is too long
+static bool ls_ext_copy(const char* ext, ssize_t len, bool fold, char* buf) {
+  if (len <= 0 || len >= IC_LS_MAX_EXT) return false;
+  for (ssize_t i = 0; i < len; i++) { buf[i] = (fold ? ic_tolower(ext[i]) : ext[i]); }
+  buf[len] = 0;
   return true;
 }
 
-static bool ls_valid_esc(ssize_t c) {
-  return ((c==0 || c==1 || c==4 || c==7 || c==22 || c==24  || c==27) ||
-    (c >= 30 && c <= 37) || (c >= 40 && c <= 47) ||
-    (c >= 90 && c <= 97) || (c >= 100 && c <= 107));
+static ls_ext_t* ls_colors_ext_find(const ls_colors_t* lsc, const char* ext) {
+  if (lsc->exts_size == 0) return NULL;
+  ssize_t i = (ssize_t)(ic_strhash(ext) & (uint32_t)(lsc->exts_size - 1));
+  while (lsc->exts[i].ext != NULL) {
+    if (strcmp(lsc->exts[i].ext, ext) == 0) return &lsc->exts[i];
+    i = (i + 1) & (lsc->exts_size - 1);
+  }
+  return &lsc->exts[i];  // empty slot
 }
 
-static bool ls_colors_from_key(stringbuf_t* sb, const char* key) {
-  // find key
-  ssize_t keylen = ic_strlen(key);
-  if (keylen <= 0) return false;
-  const char* p = strstr(ls_colors, key);
-  if (p == NULL) return false;
-  p += keylen;
-  if (key[keylen-1] != '=') {
-    if (*p != '=') return false;
-    p++;
+static void ls_colors_ext_add(ls_colors_t* lsc, const char* ext, ssize_t len, bool fold, const char* bbcode) {
+  char buf[IC_LS_MAX_EXT];
+  if (!ls_ext_copy(ext, len, fold, buf)) return;
+  if (2*(lsc->exts_count + 1) > lsc->exts_size) {
+    const ssize_t newsize = (lsc->exts_size == 0 ? 64 : 2*lsc->exts_size);
+    ls_ext_t* newexts = mem_zalloc_tp_n(lsc->mem, ls_ext_t, newsize);
+    if (newexts == NULL) return;
+    ls_ext_t* old = lsc->exts;
+    const ssize_t oldsize = lsc->exts_size;
+    lsc->exts = newexts;
+    lsc->exts_size = newsize;
+    for (ssize_t i = 0; i < oldsize; i++) {
+      if (old[i].ext != NULL) { *ls_colors_ext_find(lsc, old[i].ext) = old[i]; }
+    }
+    mem_free(lsc->mem, old);
   }
-  ssize_t len = 0;
-  while (p[len] != 0 && p[len] != ':') {
-    len++;
+  ls_ext_t* e = ls_colors_ext_find(lsc, buf);
+  if (e->ext == NULL) {
+    e->ext = arena_strdup(lsc->strings, buf);
+    if (e->ext == NULL) return;
+    lsc->exts_count++;
+  }
+  else if (fold && e->exact) {
+    return;  // an exact entry takes precedence
+  }
+  e->bbcode = bbcode;  // otherwise later entries take precedence
+  e->exact = !fold;
+}
+
+// GNU style: `di=01;34:ln=01;36:*.tar=01;31:...`
+static void ls_colors_parse_gnu(ls_colors_t* lsc, const char* s, stringbuf_t* sb) {
+  while (*s != 0) {
+    ssize_t len = 0;
+    while (s[len] != 0 && s[len] != ':') { len++; }
+    const char* eq = (const char*)memchr(s, '=', to_size_t(len));
+    if (eq != NULL && eq > s) {
+      const char* val = eq + 1;
+      const ssize_t vlen = (s + len) - val;
+      bool valid = (vlen > 0);
+      for (ssize_t i = 0; i < vlen; i++) {
+        if (!((val[i] >= '0' && val[i] <= '9') || val[i] == ';')) { valid = false; }
+      }
+      if (valid) {
+        sbuf_clear(sb);
+        sbuf_append(sb, "[ansi-sgr=\"");
+        sbuf_append_n(sb, val, vlen);
+        sbuf_append(sb, "\"]");
+        const char* bbcode = arena_strdup(lsc->strings, sbuf_string(sb));
+        const ssize_t klen = eq - s;
+        if (bbcode == NULL) {
+          // out of memory
+        }
+        else if (s[0] == '*') {
+          // match exactly, or case insensitively if there is no exact match
+          ls_colors_ext_add(lsc, s + 1, klen - 1, false, bbcode);
+          ls_colors_ext_add(lsc, s + 1, klen - 1, true, bbcode);
+        }
+        else if (klen == 2) {
+          for (ssize_t ft = 0; ft < FT_LAST; ft++) {
+            if (s[0] == ls_colors_names[ft][0] && s[1] == ls_colors_names[ft][1]) {
+              lsc->types[ft] = bbcode;
+            }
+          }
+        }
+      }
+    }
+    s += len;
+    if (*s == ':') { s++; }
   }
-  if (len <= 0) return false;
-  sbuf_append(sb, "[ansi-sgr=\"" );
-  sbuf_append_n(sb, p, len );
-  sbuf_append(sb, "\"]");
-  return true;
 }
 
 static int ls_colors_from_char(char c) {
@@ -336,87 +502,165 @@ static int ls_colors_from_char(char c) {
   else return 256; // default
 }
 
-static bool ls_colors_append(stringbuf_t* sb, file_type_t ft, const char* ext) {
-  if (!ls_colors_init()) return false;
-  if (ls_colors != NULL) {
-    // GNU style
-    if (ft == FT_DEFAULT && ext != NULL) {
-      // first try extension match
-      if (ls_colors_from_key(sb, ext)) return true;
-    }
-    if (ft >= FT_DEFAULT && ft < FT_LAST) {
-      // then a filetype match
-      const char* key = ls_colors_names[ft];
-      if (ls_colors_from_key(sb, key)) return true;
-    }    
-  }
-  else if (lscolors != NULL) {
-    // BSD style
+// BSD style: a foreground and background letter for each file type, e.g. `exfxcxdxbxegedabagacad`
+static void ls_colors_parse_bsd(ls_colors_t* lsc, const char* s, stringbuf_t* sb) {
+  const ssize_t len = ic_strlen(s);
+  for (ssize_t ft = 0; ft < FT_LAST; ft++) {
     char fg = 'x';
     char bg = 'x';
-    if (ic_strlen(lscolors) > (2*(ssize_t)ft)+1) {
-      fg = lscolors[2*ft];
-      bg = lscolors[2*ft + 1];
+    if (len > (2*ft)+1) {
+      fg = s[2*ft];
+      bg = s[2*ft + 1];
     }
+    sbuf_clear(sb);
     sbuf_appendf(sb, "[ansi-color=%d ansi-bgcolor=%d]", ls_colors_from_char(fg), ls_colors_from_char(bg) );
-    return true;
+    lsc->types[ft] = arena_strdup(lsc->strings, sbuf_string(sb));
   }
-  return false;
 }
 
-static void ls_colorize(bool no_lscolor, stringbuf_t* sb, file_type_t ft, const char* name, const char* ext, char dirsep) {
-  bool close = (no_lscolor ? false : ls_colors_append( sb, ft, ext));
+static void ls_colors_free(ls_colors_t* lsc) {
+  if (lsc == NULL) return;
+  arena_free(lsc->strings);
+  mem_free(lsc->mem, lsc->exts);
+  mem_free(lsc->mem, lsc);
+}
+
+// Parse the LS colors from the environment; returns NULL if colors are not enabled.
+static ls_colors_t* ls_colors_new(alloc_t* mem) {
+  // colors enabled?
+  const char* s = getenv("CLICOLOR");
+  if (s==NULL || (strcmp(s, "1")!=0 && strcmp(s, "") != 0)) return NULL;
+  ls_colors_t* lsc = mem_zalloc_tp(mem, ls_colors_t);
+  if (lsc == NULL) return NULL;
+  lsc->mem = mem;
+  lsc->strings = arena_new(mem);
+  stringbuf_t* sb = sbuf_new(mem);
+  if (lsc->strings == NULL || sb == NULL) {
+    sbuf_free(sb);
+    ls_colors_free(lsc);
+    return NULL;
+  }
+  const char* gnu = getenv("LS_COLORS");
+  if (gnu != NULL) {
+    ls_colors_parse_gnu(lsc, gnu, sb);
+  }
+  else {
+    const char* bsd = getenv("LSCOLORS");
+    ls_colors_parse_bsd(lsc, (bsd != NULL ? bsd : "exfxcxdxbxegedabagacad"), sb);  // default BSD setting
+  }
+  sbuf_free(sb);
+  return lsc;
+}
+
+// The bbcode for a file name: the extension is only considered for regular files.
+static const char* ls_colors_lookup(const ls_colors_t* lsc, file_type_t ft, const char* name) {
+  if (ft == FT_DEFAULT && lsc->exts_count > 0) {
+    const char* ext = strrchr(name, '.');
+    char buf[IC_LS_MAX_EXT];
+    for (int fold = 0; fold <= 1 && ext != NULL; fold++) {
+      if (!ls_ext_copy(ext, ic_strlen(ext), fold != 0, buf)) break;
+      const ls_ext_t* e = ls_colors_ext_find(lsc, buf);
+      if (e != NULL && e->ext != NULL) return e->bbcode;
+    }
+  }
+  if (ft >= FT_DEFAULT && ft < FT_LAST) return lsc->types[ft];
+  return NULL;
+}
+
+static void ls_colorize(const ls_colors_t* lsc, stringbuf_t* sb, file_type_t ft, const char* name, char dirsep) {
+  const char* bbcode = (lsc == NULL ? NULL : ls_colors_lookup(lsc, ft, name));
+  if (bbcode != NULL) { sbuf_append(sb, bbcode); }
   sbuf_append(sb, "[!pre]" );
   sbuf_append(sb, name);
   if (dirsep != 0) sbuf_append_char(sb, dirsep);
   sbuf_append(sb,"[/pre]" );
-  if (close) { sbuf_append(sb, "[/]"); }
+  if (bbcode != NULL) { sbuf_append(sb, "[/]"); }
 }
 
 #if defined(_WIN32)
 #include <io.h>
 #include <sys/stat.h>
 
-static bool os_is_dir(const char* cpath) {
-  struct _stat64 st = { 0 };
-  _stat64(cpath, &st);
-  return ((st.st_mode & _S_IFDIR) != 0);
-}
-
-static file_type_t os_get_filetype(const char* cpath) {
-  struct _stat64 st = { 0 };
-  _stat64(cpath, &st);
-  if (((st.st_mode) & _S_IFDIR) != 0) return FT_DIR;
-  if (((st.st_mode) & _S_IFCHR) != 0) return FT_CHAR;
-  if (((st.st_mode) & _S_IFIFO) != 0) return FT_PIPE;
-  if (((st.st_mode) & _S_IEXEC) != 0) return FT_EXE;
+static file_type_t os_filetype_from_mode(unsigned int mode) {
+  if ((mode & _S_IFDIR) != 0) return FT_DIR;
+  if ((mode & _S_IFCHR) != 0) return FT_CHAR;
+  if ((mode & _S_IFIFO) != 0) return FT_PIPE;
+  if ((mode & _S_IEXEC) != 0) return FT_EXE;
   return FT_DEFAULT;
 }
 
+typedef struct dir_cursor_s {
+  intptr_t               handle;  // -1 once closed
+  struct __finddata64_t  entry;
+} dir_cursor;
 
-#define dir_cursor intptr_t
-#define dir_entry  struct __finddata64_t
-
-static bool os_findfirst(alloc_t* mem, const char* path, dir_cursor* d, dir_entry* entry) {
+static bool os_findfirst(alloc_t* mem, const char* path, dir_cursor* d) {
+  d->handle = -1;
   stringbuf_t* spath = sbuf_new(mem);
   if (spath == NULL) return false;
   sbuf_append(spath, path);
   sbuf_append(spath, "\\*");
-  *d = _findfirsti64(sbuf_string(spath), entry);
-  mem_free(mem,spath);
-  return (*d != -1);
+  d->handle = _findfirsti64(sbuf_string(spath), &d->entry);
+  sbuf_free(spath);
+  return (d->handle != -1);
+}
+
+static bool os_findnext(dir_cursor* d) {
+  return (_findnexti64(d->handle, &d->entry) == 0);  
 }
 
-static bool os_findnext(dir_cursor d, dir_entry* entry) {
-  return (_findnexti64(d, entry) == 0);  
+static void os_findclose(dir_cursor* d) {
+  if (d->handle != -1) { _findclose(d->handle); }
+  d->handle = -1;
+}
+
+static const char* os_direntry_name(dir_cursor* d) {
+  return d->entry.name;  
+}
+
+// the type of the current entry as far as known from the listing (FT_LAST and -1 if not known)
+static void os_direntry_type(dir_cursor* d, file_type_t* ft, int8_t* isdir) {
+  if ((d->entry.attrib & _A_SUBDIR) != 0) { *ft = FT_DIR; *isdir = 1; }
+  else { *ft = FT_LAST; *isdir = 0; }
+}
+
+// a directory whose entries are inspected by path
+typedef struct dir_handle_s {
+  const char* path;
+} dir_handle;
+
+static void os_dirhandle_init(dir_handle* h, const char* path) {
+  h->path = path;
+}
+
+static void os_dirhandle_close(dir_handle* h) {
+  ic_unused(h);
+}
+
+// determine the type of an entry `name` in the directory of the handle
+static void os_direntry_stat(dir_handle* h, const char* name, file_type_t* ft, int8_t* isdir) {
+  char path[_MAX_PATH];
+  struct _stat64 st = { 0 };
+  if (snprintf(path, sizeof(path), "%s\\%s", h->path, name) < (int)sizeof(path)) {
+    _stat64(path, &st);
+  }
+  *ft = os_filetype_from_mode(st.st_mode);
+  *isdir = ((st.st_mode & _S_IFDIR) != 0 ? 1 : 0);
 }
 
-static void os_findclose(dir_cursor d) {
-  _findclose(d);
+typedef struct dir_stamp_s {
+  int64_t mtime;
+} dir_stamp_t;
+
+static bool os_dir_stamp(const char* cpath, dir_stamp_t* stamp) {
+  struct _stat64 st = { 0 };
+  if (_stat64(cpath, &st) != 0 || (st.st_mode & _S_IFDIR) == 0) return false;
+  stamp->mtime = (int64_t)st.st_mtime;
+  return true;
 }
 
-static const char* os_direntry_name(dir_entry* entry) {
-  return entry->name;  
+static bool os_dir_stamp_eq(const dir_stamp_t* s1, const dir_stamp_t* s2) {
+  return (s1->mtime == s2->mtime);
 }
 
 static bool os_path_is_absolute( const char* path ) {
@@ -435,20 +679,12 @@ ic_private char ic_dirsep(void) {
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 
-static bool os_is_dir(const char* cpath) {
-  struct stat st;
-  memset(&st, 0, sizeof(st));
-  stat(cpath, &st);
-  return (S_ISDIR(st.st_mode));
-}
-
-static file_type_t os_get_filetype(const char* cpath) {
-  struct stat st;
-  memset(&st, 0, sizeof(st));
-  lstat(cpath, &st);
-  switch ((st.st_mode)&S_IFMT) {
+static file_type_t os_filetype_from_mode(mode_t mode) {
+  switch (mode & S_IFMT) {
     case S_IFSOCK: return FT_SOCK;
     case S_IFLNK: {
       return FT_SYM;
@@ -457,47 +693,133 @@ static file_type_t os_get_filetype(const char* cpath) {
     case S_IFCHR:  return FT_CHAR;
     case S_IFBLK:  return FT_BLOCK;
     case S_IFDIR: {
-      if ((st.st_mode & S_ISUID) != 0) return FT_SETUID;
-      if ((st.st_mode & S_ISGID) != 0) return FT_SETGID;
-      if ((st.st_mode & S_IWGRP) != 0 && (st.st_mode & S_ISVTX) != 0) return FT_DIR_OW_STICKY;
-      if ((st.st_mode & S_IWGRP)) return FT_DIR_OW;
-      if ((st.st_mode & S_ISVTX)) return FT_DIR_STICKY;
+      if ((mode & S_ISUID) != 0) return FT_SETUID;
+      if ((mode & S_ISGID) != 0) return FT_SETGID;
+      if ((mode & S_IWGRP) != 0 && (mode & S_ISVTX) != 0) return FT_DIR_OW_STICKY;
+      if ((mode & S_IWGRP)) return FT_DIR_OW;
+      if ((mode & S_ISVTX)) return FT_DIR_STICKY;
       return FT_DIR;
     }
     case S_IFREG:
     default: {
-      if ((st.st_mode & S_IXUSR) != 0) return FT_EXE;
+      if ((mode & S_IXUSR) != 0) return FT_EXE;
       return FT_DEFAULT;
     }
   }  
 }
 
+typedef struct dir_cursor_s {
+  DIR*            dir;
+  struct dirent*  entry;   // current entry (with the `d_type` if the file system provides it)
+} dir_cursor;
 
-#define dir_cursor DIR*
-#define dir_entry  struct dirent*
-
-static bool os_findnext(dir_cursor d, dir_entry* entry) {
-  *entry = readdir(d);
-  return (*entry != NULL);
+static bool os_findnext(dir_cursor* d) {
+  d->entry = readdir(d->dir);
+  return (d->entry != NULL);
 }
 
-static bool os_findfirst(alloc_t* mem, const char* cpath, dir_cursor* d, dir_entry* entry) {
+static bool os_findfirst(alloc_t* mem, const char* cpath, dir_cursor* d) {
   ic_unused(mem);
-  *d = opendir(cpath);
-  if (*d == NULL) {
+  d->entry = NULL;
+  d->dir = opendir(cpath);
+  if (d->dir == NULL) {
     return false;
   }
   else {
-    return os_findnext(*d, entry);
+    return os_findnext(d);
   }
 }
 
-static void os_findclose(dir_cursor d) {
-  closedir(d);
+static void os_findclose(dir_cursor* d) {
+  if (d->dir != NULL) { closedir(d->dir); }
+  d->dir = NULL;
+  d->entry = NULL;
 }
 
-static const char* os_direntry_name(dir_entry* entry) {
-  return (*entry)->d_name;  
+static const char* os_direntry_name(dir_cursor* d) {
+  return d->entry->d_name;  
+}
+
+// the type of the current entry as far as known from the listing (FT_LAST and -1 if not known)
+static void os_direntry_type(dir_cursor* d, file_type_t* ft, int8_t* isdir) {
+  *ft = FT_LAST;
+  *isdir = -1;
+  #if defined(DT_UNKNOWN)
+  switch (d->entry->d_type) {
+    case DT_DIR:  *isdir = 1; break;    // the mode is still needed for the exact type
+    case DT_REG:  *isdir = 0; break;    // and for executables
+    case DT_LNK:  *ft = FT_SYM; break;  // but it may point to a directory
+    case DT_SOCK: *ft = FT_SOCK;  *isdir = 0; break;
+    case DT_FIFO: *ft = FT_PIPE;  *isdir = 0; break;
+    case DT_CHR:  *ft = FT_CHAR;  *isdir = 0; break;
+    case DT_BLK:  *ft = FT_BLOCK; *isdir = 0; break;
+    default: break;
+  }
+  #else
+  ic_unused(d);
+  #endif
+}
+
+// A directory that is opened on first use to inspect its entries with
+// `fstatat` (without building paths); it is only kept open while
+// a listing is being completed.
+typedef struct dir_handle_s {
+  const char* path;
+  int         fd;      // -1 if not opened (yet)
+} dir_handle;
+
+static void os_dirhandle_init(dir_handle* h, const char* path) {
+  h->path = path;
+  h->fd = -1;
+}
+
+static void os_dirhandle_close(dir_handle* h) {
+  if (h->fd >= 0) { close(h->fd); }
+  h->fd = -1;
+}
+
+// determine the type of an entry `name` in the directory of the handle
+static void os_direntry_stat(dir_handle* h, const char* name, file_type_t* ft, int8_t* isdir) {
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  if (h->fd < 0) { h->fd = open(h->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC); }
+  const int fd = h->fd;
+  if (fd < 0) { *ft = FT_DEFAULT; *isdir = 0; return; }
+  fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW);
+  *ft = os_filetype_from_mode(st.st_mode);
+  if (S_ISLNK(st.st_mode)) {
+    // follow the link to see if it is a directory
+    memset(&st, 0, sizeof(st));
+    fstatat(fd, name, &st, 0);
+  }
+  *isdir = (S_ISDIR(st.st_mode) ? 1 : 0);
+}
+
+// identity and modification time of a directory
+typedef struct dir_stamp_s {
+  dev_t   dev;
+  ino_t   ino;
+  int64_t mtime;
+  long    mtime_nsec;
+} dir_stamp_t;
+
+static bool os_dir_stamp(const char* cpath, dir_stamp_t* stamp) {
+  struct stat st;
+  if (stat(cpath, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+  stamp->dev = st.st_dev;
+  stamp->ino = st.st_ino;
+  stamp->mtime = (int64_t)st.st_mtime;
+  #if defined(__linux__)
+  stamp->mtime_nsec = (long)st.st_mtim.tv_nsec;
+  #else
+  stamp->mtime_nsec = 0;
+  #endif
+  return true;
+}
+
+static bool os_dir_stamp_eq(const dir_stamp_t* s1, const dir_stamp_t* s2) {
+  return (s1->dev == s2->dev && s1->ino == s2->ino &&
+          s1->mtime == s2->mtime && s1->mtime_nsec == s2->mtime_nsec);
 }
 
 static bool os_path_is_absolute( const char* path ) {
@@ -510,6 +832,265 @@ ic_private char ic_dirsep(void) {
 #endif
 
 
+//-------------------------------------------------------------
+// Directory listings
+//
+// The file name completer runs on every tab and hint refresh,
+// so the entries of the last few directories are cached. A
+// listing is valid as long as the directory has the same
+// identity and modification time; this takes one `stat` instead
+// of reading the directory again. The type of an entry comes from
+// the listing where possible and is otherwise determined once it
+// matches a prefix (and is then kept; a changed mode of an
+// existing file is not noticed). A listing does not keep its
+// directory open; caching can be disabled with `ic_enable_dircache`.
+//-------------------------------------------------------------
+
+#define IC_DIRCACHE_MAX  (32)  // default number of directories that are cached (enough for a typical PATH)
+
+typedef struct dir_item_s {
+  const char*  name;
+  file_type_t  ft;        // FT_LAST if not yet determined
+  int8_t       isdir;     // -1 if not yet determined
+} dir_item_t;
+
+typedef struct dir_listing_s {
+  struct dir_listing_s* next;  // cached listings, most recently used first
+  char*        path;
+  dir_stamp_t  stamp;
+  bool         racy;           // was the directory modified just before it was read?
+  ssize_t      refcount;       // the cache and each user hold a reference
+  ssize_t      count;
+  ssize_t      size;
+  dir_item_t*  items;
+  arena_t*     names;
+} dir_listing_t;
+
+struct dircache_s {
+  alloc_t*        mem;
+  ic_mutex_t*     lock;        // completers can run concurrently in the background
+  dir_listing_t*  listings;
+  bool            disabled;    // read listings without caching them?
+  ssize_t         max;         // maximal number of cached listings (>= 1)
+  ls_colors_t*    lscolors;    // parsed on first use (NULL if colors are disabled)
+  bool            lscolors_parsed;
+};
+
+ic_private dircache_t* dircache_new(alloc_t* mem) {
+  dircache_t* dc = mem_zalloc_tp(mem, dircache_t);
+  if (dc == NULL) return NULL;
+  dc->mem = mem;
+  dc->max = IC_DIRCACHE_MAX;
+  dc->lock = mutex_new(mem);
+  return dc;
+}
+
+static void dir_listing_free(alloc_t* mem, dir_listing_t* dl) {
+  if (dl == NULL) return;
+  arena_free(dl->names);
+  mem_free(mem, dl->items);
+  mem_free(mem, dl->path);
+  mem_free(mem, dl);
+}
+
+// drop a reference (under the lock)
+static void dir_listing_unref(alloc_t* mem, dir_listing_t* dl) {
+  if (dl == NULL) return;
+  dl->refcount--;
+  if (dl->refcount <= 0) { dir_listing_free(mem, dl); }
+}
+
+// drop all but the `keep` most recently used listings (under the lock)
+static void dircache_trim(dircache_t* dc, ssize_t keep) {
+  dir_listing_t** prev = &dc->listings;
+  for (ssize_t n = 0; *prev != NULL && n < keep; n++) { prev = &(*prev)->next; }
+  dir_listing_t* dl = *prev;
+  *prev = NULL;
+  while (dl != NULL) {
+    dir_listing_t* next = dl->next;
+    dir_listing_unref(dc->mem, dl);
+    dl = next;
+  }
+}
+
+static void dircache_clear(dircache_t* dc) {
+  dircache_trim(dc, 0);
+}
+
+ic_private void dircache_free(dircache_t* dc) {
+  if (dc == NULL) return;
+  dircache_clear(dc);
+  ls_colors_free(dc->lscolors);
+  mutex_free(dc->mem, dc->lock);
+  mem_free(dc->mem, dc);
+}
+
+// Enable or disable caching; disabling drops the cached listings.
+ic_private bool dircache_enable(dircache_t* dc, bool enable) {
+  if (dc == NULL) return false;
+  mutex_lock(dc->lock);
+  const bool prev = !dc->disabled;
+  dc->disabled = !enable;
+  if (!enable) { dircache_clear(dc); }
+  mutex_unlock(dc->lock);
+  return prev;
+}
+
+// Set the maximal number of cached listings; returns the previous maximum.
+ic_private ssize_t dircache_set_max(dircache_t* dc, ssize_t max) {
+  if (dc == NULL) return 0;
+  if (max < 1) max = 1;
+  mutex_lock(dc->lock);
+  const ssize_t prev = dc->max;
+  dc->max = max;
+  dircache_trim(dc, max);
+  mutex_unlock(dc->lock);
+  return prev;
+}
+
+// Get the LS colors (or NULL if colors are not used).
+static const ls_colors_t* dircache_lscolors(ic_env_t* env) {
+  dircache_t* dc = env->dircache;
+  if (env->no_lscolors || dc == NULL) return NULL;
+  mutex_lock(dc->lock);
+  if (!dc->lscolors_parsed) {
+    dc->lscolors = ls_colors_new(dc->mem);
+    dc->lscolors_parsed = true;
+  }
+  const ls_colors_t* lsc = dc->lscolors;
+  mutex_unlock(dc->lock);
+  return lsc;
+}
+
+static bool dir_listing_push(alloc_t* mem, dir_listing_t* dl, const char* name, file_type_t ft, int8_t isdir) {
+  if (dl->count >= dl->size) {
+    ssize_t newsize = (dl->size == 0 ? 64 : 2*dl->size);
+    dir_item_t* newitems = mem_realloc_tp(mem, dir_item_t, dl->items, newsize);
+    if (newitems == NULL) return false;
+    dl->items = newitems;
+    dl->size = newsize;
+  }
+  const char* s = arena_strdup(dl->names, name);
+  if (s == NULL) return false;
+  dir_item_t* item = &dl->items[dl->count++];
+  item->name = s;
+  item->ft = ft;
+  item->isdir = isdir;
+  return true;
+}
+
+static dir_listing_t* dir_listing_read(alloc_t* mem, const char* path, const dir_stamp_t* stamp) {
+  dir_listing_t* dl = mem_zalloc_tp(mem, dir_listing_t);
+  if (dl == NULL) return NULL;
+  dl->path = mem_strdup(mem, path);
+  dl->names = arena_new(mem);
+  if (dl->path == NULL || dl->names == NULL) {
+    dir_listing_free(mem, dl);
+    return NULL;
+  }
+  dl->stamp = *stamp;
+  // a directory modified in the same second may change without a new time stamp
+  dl->racy = (stamp->mtime + 1 >= (int64_t)time(NULL));
+  dl->refcount = 1;
+  dir_cursor cursor;
+  if (os_findfirst(mem, path, &cursor)) {
+    do {
+      const char* name = os_direntry_name(&cursor);
+      if (name != NULL && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+        file_type_t ft;
+        int8_t isdir;
+        os_direntry_type(&cursor, &ft, &isdir);
+        if (!dir_listing_push(mem, dl, name, ft, isdir)) break;
+      }
+    } while (os_findnext(&cursor));
+  }
+  os_findclose(&cursor);  // do not keep a descriptor open for cached listings
+  return dl;
+}
+
+// Get the listing of a directory, reading it if it was not cached or has changed.
+// Returns NULL if the directory cannot be read; release with `dircache_release`.
+static dir_listing_t* dircache_acquire(ic_env_t* env, const char* path) {
+  dir_stamp_t stamp;
+  if (!os_dir_stamp(path, &stamp)) return NULL;
+  dircache_t* dc = env->dircache;
+  if (dc == NULL) return dir_listing_read(env->mem, path, &stamp);  // uncached
+  mutex_lock(dc->lock);
+  if (dc->disabled) {
+    mutex_unlock(dc->lock);
+    return dir_listing_read(dc->mem, path, &stamp);  // uncached (freed on release)
+  }
+  dir_listing_t** prev = &dc->listings;
+  while (*prev != NULL && strcmp((*prev)->path, path) != 0) { prev = &(*prev)->next; }
+  dir_listing_t* dl = *prev;
+  if (dl != NULL) {
+    *prev = dl->next;
+    if (!dl->racy && os_dir_stamp_eq(&dl->stamp, &stamp)) {
+      // still valid: move to the front
+      dl->next = dc->listings;
+      dc->listings = dl;
+      dl->refcount++;
+      mutex_unlock(dc->lock);
+      return dl;
+    }
+    dir_listing_unref(dc->mem, dl);  // stale
+  }
+  mutex_unlock(dc->lock);
+
+  dl = dir_listing_read(dc->mem, path, &stamp);
+  if (dl == NULL) return NULL;
+
+  mutex_lock(dc->lock);
+  // insert at the front (replacing a listing another thread may have read meanwhile)
+  prev = &dc->listings;
+  ssize_t n = 1;
+  while (*prev != NULL) {
+    dir_listing_t* cur = *prev;
+    if (n >= dc->max || strcmp(cur->path, path) == 0) {
+      *prev = cur->next;
+      dir_listing_unref(dc->mem, cur);
+    }
+    else {
+      prev = &cur->next;
+      n++;
+    }
+  }
+  dl->next = dc->listings;
+  dc->listings = dl;
+  dl->refcount++;
+  mutex_unlock(dc->lock);
+  return dl;
+}
+
+static void dircache_release(ic_env_t* env, dir_listing_t* dl) {
+  dircache_t* dc = env->dircache;
+  if (dc == NULL) { dir_listing_free(env->mem, dl); return; }
+  mutex_lock(dc->lock);
+  dir_listing_unref(dc->mem, dl);
+  mutex_unlock(dc->lock);
+}
+
+// Determine if an entry is a directory, and its exact file type if `need_ft` is set
+// (only used for coloring). At most one `stat` (or two for a symbolic link) is needed once.
+// The `stat` is done outside the lock so roots can be listed in parallel; `dh` is
+// the directory handle of the listing (opened on demand and closed by the caller).
+static void dircache_item_type(ic_env_t* env, dir_handle* dh, dir_item_t* item, bool need_ft, file_type_t* ft, bool* isdir) {
+  ic_mutex_t* lock = (env->dircache != NULL ? env->dircache->lock : NULL);
+  mutex_lock(lock);
+  file_type_t ift = item->ft;
+  int8_t idir = item->isdir;
+  mutex_unlock(lock);
+  if (idir < 0 || (need_ft && ift == FT_LAST)) {
+    os_direntry_stat(dh, item->name, &ift, &idir);
+    mutex_lock(lock);
+    item->ft = ift;
+    item->isdir = idir;
+    mutex_unlock(lock);
+  }
+  *ft = (ift == FT_LAST ? FT_DEFAULT : ift);
+  *isdir = (idir > 0);
+}
+
 
 //-------------------------------------------------------------
 // File completion 
@@ -548,50 +1129,227 @@ static bool match_extension(const char* name, const char* extensions) {
   return false;
 }
 
-static bool filename_complete_indir( ic_completion_env_t* cenv, stringbuf_t* dir, 
-                                      stringbuf_t* dir_prefix, stringbuf_t* display,
-                                       const char* base_prefix, 
-                                        char dir_sep, const char* extensions ) 
+// Set of names that were completed already (when completing in multiple roots).
+typedef struct name_set_s {
+  alloc_t*      mem;
+  const char**  names;
+  ssize_t       size;    // 0 or a power of 2
+  ssize_t       count;
+} name_set_t;
+
+// Insert a name (that stays valid); returns false if it was present already.
+static bool name_set_insert(name_set_t* set, const char* name) {
+  if (2*(set->count + 1) > set->size) {
+    const ssize_t newsize = (set->size == 0 ? 64 : 2*set->size);
+    const char** newnames = mem_zalloc_tp_n(set->mem, const char*, newsize);
+    if (newnames == NULL) return true;  // out of memory: allow duplicates
+    for (ssize_t i = 0; i < set->size; i++) {
+      const char* n = set->names[i];
+      if (n == NULL) continue;
+      ssize_t j = (ssize_t)(ic_strhash(n) & (uint32_t)(newsize - 1));
+      while (newnames[j] != NULL) { j = (j + 1) & (newsize - 1); }
+      newnames[j] = n;
+    }
+    mem_free(set->mem, set->names);
+    set->names = newnames;
+    set->size = newsize;
+  }
+  ssize_t i = (ssize_t)(ic_strhash(name) & (uint32_t)(set->size - 1));
+  while (set->names[i] != NULL) {
+    if (strcmp(set->names[i], name) == 0) return false;
+    i = (i + 1) & (set->size - 1);
+  }
+  set->names[i] = name;
+  set->count++;
+  return true;
+}
+
+// Add the entries of a directory listing that start with `base_prefix`.
+static bool filename_complete_listing( ic_completion_env_t* cenv, dir_listing_t* dl,
+                                        stringbuf_t* dir_prefix, stringbuf_t* display,
+                                         const char* base_prefix, name_set_t* seen,
+                                          char dir_sep, const char* extensions ) 
 {
-  dir_cursor d = 0;
-  dir_entry entry;
   bool cont = true;
-  if (os_findfirst(cenv->env->mem, sbuf_string(dir), &d, &entry)) {
-    do {
-      const char* name = os_direntry_name(&entry);
-      if (name != NULL && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && 
-          ic_istarts_with(name, base_prefix))
+  const ls_colors_t* lsc = dircache_lscolors(cenv->env);
+  dir_handle dh;
+  os_dirhandle_init(&dh, dl->path);
+  for (ssize_t i = 0; cont && i < dl->count; i++) {
+    dir_item_t* item = &dl->items[i];
+    const char* name = item->name;
+    if (ic_istarts_with(name, base_prefix))
+    {
+      // possible match, first check if it is a directory
+      file_type_t ft;
+      bool isdir;
+      dircache_item_type(cenv->env, &dh, item, (lsc != NULL), &ft, &isdir);
+      if ((isdir || match_extension(name, extensions)) &&
+          (seen == NULL || name_set_insert(seen, name)))  // an earlier root takes precedence
       {
-        // possible match, first check if it is a directory
-        file_type_t ft;
-        bool isdir;
+        // add completion
         const ssize_t plen = sbuf_len(dir_prefix);
         sbuf_append(dir_prefix, name);
-        { // check directory and potentially add a dirsep to the dir_prefix
-          const ssize_t dlen = sbuf_len(dir);
-          sbuf_append_char(dir,ic_dirsep());
-          sbuf_append(dir,name);
-          ft = os_get_filetype(sbuf_string(dir));
-          isdir = os_is_dir(sbuf_string(dir));
-          if (isdir && dir_sep != 0) {
-            sbuf_append_char(dir_prefix,dir_sep); 
-          }
-          sbuf_delete_from(dir,dlen);  // restore dir
-        }
-        if (isdir || match_extension(name, extensions)) {
-          // add completion
-          sbuf_clear(display);
-          ls_colorize(cenv->env->no_lscolors, display, ft, name, NULL, (isdir ? dir_sep : 0));
-          cont = ic_add_completion_ex(cenv, sbuf_string(dir_prefix), sbuf_string(display), NULL);
+        if (isdir && dir_sep != 0) {
+          sbuf_append_char(dir_prefix,dir_sep); 
         }
+        sbuf_clear(display);
+        ls_colorize(lsc, display, ft, name, (isdir ? dir_sep : 0));
+        cont = ic_add_completion_ex(cenv, sbuf_string(dir_prefix), sbuf_string(display), NULL);
         sbuf_delete_from( dir_prefix, plen ); // restore dir_prefix
       }
-    } while (cont && os_findnext(d, &entry));
-    os_findclose(d);
+    }
   }
+  os_dirhandle_close(&dh);
   return cont;
 }
 
+
+//-------------------------------------------------------------
+// Completing in multiple roots
+//
+// The roots are claimed in order by the completer thread and
+// (in parallel mode) a few helper threads. Listing a root reads
+// the directory and determines the type of the matching entries;
+// the completer thread adds the completions of the listed roots
+// in order so the result is the same as when done sequentially.
+//-------------------------------------------------------------
+
+#define IC_FILENAME_THREADS  (4)   // maximal threads listing roots in parallel
+
+typedef struct filename_root_s {
+  char*           dir;       // root with the directory part of the prefix
+  dir_listing_t*  listing;   // NULL if it cannot be read
+  bool            done;      // is it listed? (guarded by the pool `lock`)
+} filename_root_t;
+
+typedef struct filename_pool_s {
+  ic_env_t*         env;
+  ic_mutex_t*       lock;
+  filename_root_t*  roots;
+  ssize_t           count;
+  ssize_t           next;      // next root to list (guarded by `lock`)
+  bool              stop;      // stop listing (guarded by `lock`)
+  const char*       base_prefix;
+  bool              need_ft;
+} filename_pool_t;
+
+// claim the next root to list
+static filename_root_t* filename_pool_claim(filename_pool_t* pool) {
+  filename_root_t* root = NULL;
+  mutex_lock(pool->lock);
+  if (!pool->stop && pool->next < pool->count) {
+    root = &pool->roots[pool->next++];
+  }
+  mutex_unlock(pool->lock);
+  return root;
+}
+
+static void filename_pool_list(filename_pool_t* pool, filename_root_t* root) {
+  dir_listing_t* dl = dircache_acquire(pool->env, root->dir);
+  if (dl != NULL) {
+    dir_handle dh;
+    os_dirhandle_init(&dh, dl->path);
+    for (ssize_t i = 0; i < dl->count; i++) {
+      dir_item_t* item = &dl->items[i];
+      if (ic_istarts_with(item->name, pool->base_prefix)) {
+        file_type_t ft;
+        bool isdir;
+        dircache_item_type(pool->env, &dh, item, pool->need_ft, &ft, &isdir);
+      }
+    }
+    os_dirhandle_close(&dh);
+  }
+  mutex_lock(pool->lock);
+  root->listing = dl;
+  root->done = true;
+  mutex_unlock(pool->lock);
+}
+
+static void filename_pool_worker(void* arg) {
+  filename_pool_t* pool = (filename_pool_t*)arg;
+  filename_root_t* root;
+  while ((root = filename_pool_claim(pool)) != NULL) {
+    filename_pool_list(pool, root);
+  }
+}
+
+static bool filename_pool_is_done(filename_pool_t* pool, filename_root_t* root) {
+  mutex_lock(pool->lock);
+  const bool done = root->done;
+  mutex_unlock(pool->lock);
+  return done;
+}
+
+static void filename_complete_roots( ic_completion_env_t* cenv, filename_root_t* roots, ssize_t count,
+                                      stringbuf_t* dir_prefix, stringbuf_t* display,
+                                       const char* base_prefix, char dir_sep, const char* extensions, 
+                                        bool parallel ) 
+{
+  ic_env_t* env = cenv->env;
+  filename_pool_t pool;
+  memset(&pool, 0, sizeof(pool));
+  pool.env = env;
+  pool.roots = roots;
+  pool.count = count;
+  pool.base_prefix = base_prefix;
+  pool.need_ft = (dircache_lscolors(env) != NULL);
+  ic_thread_t* threads[IC_FILENAME_THREADS-1];
+  ssize_t nthreads = 0;
+  if (parallel && count > 1) {
+    pool.lock = mutex_new(env->mem);
+    if (pool.lock != NULL) {
+      while (nthreads < IC_FILENAME_THREADS-1 && nthreads < count-1) {
+        threads[nthreads] = thread_start(env->mem, &filename_pool_worker, &pool);
+        if (threads[nthreads] == NULL) break;
+        nthreads++;
+      }
+    }
+  }
+  name_set_t seen;
+  memset(&seen, 0, sizeof(seen));
+  seen.mem = env->mem;
+  
+  // list roots ourselves and add the completions of those listed so far, in order
+  bool cont = true;
+  ssize_t added = 0;
+  filename_root_t* root;
+  do {
+    root = (cont ? filename_pool_claim(&pool) : NULL);
+    if (root != NULL) { filename_pool_list(&pool, root); }
+    while (cont && added < count && filename_pool_is_done(&pool, &roots[added])) {
+      dir_listing_t* dl = roots[added].listing;
+      if (dl != NULL) {
+        cont = filename_complete_listing(cenv, dl, dir_prefix, display, base_prefix,
+                                          (count > 1 ? &seen : NULL), dir_sep, extensions);
+      }
+      added++;
+      if (cont && ic_stop_completing(cenv)) { cont = false; }
+    }
+    if (!cont) {
+      mutex_lock(pool.lock);
+      pool.stop = true;
+      mutex_unlock(pool.lock);
+    }
+  } while (root != NULL);
+
+  // wait for the helpers and add the remaining roots
+  for (ssize_t i = 0; i < nthreads; i++) {
+    thread_join(env->mem, threads[i]);
+  }
+  for ( ; cont && added < count && roots[added].done; added++) {
+    dir_listing_t* dl = roots[added].listing;
+    if (dl != NULL) {
+      cont = filename_complete_listing(cenv, dl, dir_prefix, display, base_prefix,
+                                        (count > 1 ? &seen : NULL), dir_sep, extensions);
+    }
+  }
+  for (ssize_t i = 0; i < count; i++) {
+    if (roots[i].listing != NULL) { dircache_release(env, roots[i].listing); }
+  }
+  mem_free(env->mem, seen.names);
+  mutex_free(env->mem, pool.lock);
+}
+
 typedef struct filename_closure_s {
   const char* roots;
   const char* extensions;
@@ -601,9 +1359,12 @@ typedef struct filename_closure_s {
 static void filename_completer( ic_completion_env_t* cenv, const char* prefix ) {
   if (prefix == NULL) return;
   filename_closure_t* fclosure = (filename_closure_t*)cenv->arg;  
-  stringbuf_t* root_dir   = sbuf_new(cenv->env->mem);
-  stringbuf_t* dir_prefix = sbuf_new(cenv->env->mem);
-  stringbuf_t* display    = sbuf_new(cenv->env->mem);  
+  alloc_t* mem = cenv->env->mem;
+  stringbuf_t* root_dir   = sbuf_new(mem);
+  stringbuf_t* dir_prefix = sbuf_new(mem);
+  stringbuf_t* display    = sbuf_new(mem);  
+  filename_root_t* roots  = NULL;
+  ssize_t count = 0;
   if (root_dir!=NULL && dir_prefix != NULL && display != NULL) 
   {
     // split prefix in dir_prefix / base.
@@ -623,15 +1384,20 @@ static void filename_completer( ic_completion_env_t* cenv, const char* prefix )
       if (base != NULL) {
         sbuf_append_n( root_dir, prefix, (base - prefix));  // include dir separator
       }
-      filename_complete_indir( cenv, root_dir, dir_prefix, display,  
-                                (base != NULL ? base : prefix), 
-                                 fclosure->dir_sep, fclosure->extensions );   
+      roots = mem_zalloc_tp(mem, filename_root_t);
+      if (roots != NULL) {
+        roots[0].dir = sbuf_strdup(root_dir);
+        count = 1;
+      }
     }
     else {
       // relative path, complete with respect to every root.
+      ssize_t n = 1;
+      for (const char* r = fclosure->roots; (r = strchr(r, ';')) != NULL; r++) { n++; }
+      roots = mem_zalloc_tp_n(mem, filename_root_t, n);
       const char* next;
       const char* root = fclosure->roots;
-      while ( root != NULL ) {
+      while ( roots != NULL && root != NULL ) {
         // create full root in `root_dir`
         sbuf_clear(root_dir);
         next = strchr(root,';');
@@ -649,14 +1415,26 @@ static void filename_completer( ic_completion_env_t* cenv, const char* prefix )
         if (base != NULL) {
           sbuf_append_n( root_dir, prefix, (base - prefix) - 1);
         }
-
-        // and complete in this directory    
-        filename_complete_indir( cenv, root_dir, dir_prefix, display,
-                                  (base != NULL ? base : prefix), 
-                                   fclosure->dir_sep, fclosure->extensions);
+        roots[count++].dir = sbuf_strdup(root_dir);
       }
     }
+
+    // and complete in these directories
+    bool ok = (roots != NULL);
+    for (ssize_t i = 0; i < count; i++) {
+      if (roots[i].dir == NULL) { ok = false; }
+    }
+    if (ok) {
+      filename_complete_roots( cenv, roots, count, dir_prefix, display,
+                                (base != NULL ? base : prefix),
+                                 fclosure->dir_sep, fclosure->extensions,
+                                  cenv->env->complete_parallel );
+    }
+  }
+  for (ssize_t i = 0; i < count; i++) {
+    mem_free(mem, roots[i].dir);
   }
+  mem_free(mem, roots);
   sbuf_free(display);
   sbuf_free(root_dir);
   sbuf_free(dir_prefix);
@@ -7,12 +7,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
 
 #include "../include/isocline.h"
 #include "common.h"
 #include "env.h"
 #include "stringbuf.h"
 #include "completions.h"
+#include "fuzzy.h"
 
 
 //-------------------------------------------------------------
@@ -25,15 +30,37 @@ typedef struct completion_s {
   const char* help;
   ssize_t     delete_before;
   ssize_t     delete_after;
+  ssize_t     len;  // length of the replacement (for sorting)
+  uint64_t    key;  // first 8 bytes of the case-folded replacement (for sorting)
+  ssize_t     width; // column width of the display and help (or -1 if not yet measured)
 } completion_t;
 
+// Bucket in the hash set of replacements that is used to skip duplicates.
+typedef struct cbucket_s {
+  uint32_t gen;       // the bucket is empty unless this equals the generation of the set
+  uint32_t hash;
+  const char* replacement;  // the replacement (in the arena, so it stays put when the completions are sorted)
+} cbucket_t;
+
 struct completions_s {
   ic_completer_fun_t* completer;
   void* completer_arg;
   ssize_t completer_max;
   ssize_t count;
   ssize_t len;
+  ssize_t sorted;     // the first `sorted` completions are in order and precede all others
   completion_t* elems;
+  arena_t* strings;   // strings of the completions (reset on a clear)
+  cbucket_t* index;   // hash set of the replacements (open addressing with linear probing)
+  ssize_t index_len;  // size of the index (a power of 2)
+  uint32_t index_gen; // current generation; incremented to clear the index at once
+  bool monotone;      // did the completer declare its completions monotone?
+  char* cache_input;  // input of the cached (monotone) completions (NULL if not valid)
+  ssize_t cache_pos;  // and the cursor position
+  bool cache_complete;  // are the cached completions not truncated?
+  bool ranked;        // are the completions ordered by a fuzzy match score? (and should not be sorted)
+  completions_job_t* job;       // running background completion (NULL if none)
+  completions_job_t* cancelled; // cancelled background completions that may still run
   alloc_t* mem;
 };
 
@@ -47,47 +74,141 @@ ic_private completions_t* completions_new(alloc_t* mem) {
   return cms;
 }
 
+static void completions_reap(completions_t* cms, bool wait);
+
 ic_private void completions_free(completions_t* cms) {
   if (cms == NULL) return;
   completions_clear(cms);  
+  completions_reap(cms, true);
   if (cms->elems != NULL) {
     mem_free(cms->mem, cms->elems);
     cms->elems = NULL;
     cms->count = 0;
     cms->len = 0;
   }
+  mem_free(cms->mem, cms->index);
+  mem_free(cms->mem, cms->cache_input);
+  arena_free(cms->strings);
   mem_free(cms->mem, cms); // free ourselves
 }
 
 
+
+//-------------------------------------------------------------
+// Hash set of replacements
+//-------------------------------------------------------------
+
+static void completions_index_clear(completions_t* cms) {
+  cms->index_gen++;
+  if (cms->index_gen == 0) {  // wrapped around: really clear all buckets
+    if (cms->index != NULL) { memset(cms->index, 0, to_size_t(cms->index_len)*sizeof(cbucket_t)); }
+    cms->index_gen = 1;
+  }
+}
+
+// the bucket that holds `replacement`, or the empty bucket where it should be inserted
+static cbucket_t* completions_index_find(completions_t* cms, const char* replacement, uint32_t hash) {
+  const ssize_t mask = cms->index_len - 1;
+  for( ssize_t i = (ssize_t)hash & mask; ; i = (i + 1) & mask) {
+    cbucket_t* b = &cms->index[i];
+    if (b->gen != cms->index_gen) return b;
+    if (b->hash == hash && strcmp(b->replacement, replacement) == 0) return b;
+  }
+}
+
+static void completions_index_insert(completions_t* cms, const char* replacement, uint32_t hash) {
+  cbucket_t* b = completions_index_find(cms, replacement, hash);
+  b->gen = cms->index_gen;
+  b->hash = hash;
+  b->replacement = replacement;
+}
+
+// (re)insert all completions
+static void completions_index_rebuild(completions_t* cms) {
+  completions_index_clear(cms);
+  for( ssize_t i = 0; i < cms->count; i++) {
+    const char* replacement = cms->elems[i].replacement;
+    if (replacement == NULL) continue;
+    completions_index_insert(cms, replacement, ic_strhash(replacement));
+  }
+}
+
+// ensure the index has room for `n` more completions (keeping the load factor below 1/2)
+static bool completions_index_reserve(completions_t* cms, ssize_t n) {
+  if (2*(cms->count + n) <= cms->index_len) return true;
+  ssize_t newlen = (cms->index_len <= 0 ? 64 : 2*cms->index_len);
+  while (newlen < 2*(cms->count + n)) { newlen *= 2; }
+  cbucket_t* newindex = mem_zalloc_tp_n(cms->mem, cbucket_t, newlen);
+  if (newindex == NULL) return false;
+  mem_free(cms->mem, cms->index);
+  cms->index = newindex;
+  cms->index_len = newlen;
+  cms->index_gen = 0;  // all buckets are empty after the clear in the rebuild
+  completions_index_rebuild(cms);
+  return true;
+}
+
+ic_private void completions_invalidate(completions_t* cms) {
+  mem_free(cms->mem, cms->cache_input);
+  cms->cache_input = NULL;
+}
+
 ic_private void completions_clear(completions_t* cms) {  
-  while (cms->count > 0) {
-    completion_t* cm = cms->elems + cms->count - 1;
-    mem_free( cms->mem, cm->display);
-    mem_free( cms->mem, cm->replacement);
-    mem_free( cms->mem, cm->help);
-    memset(cm,0,sizeof(*cm));
-    cms->count--;    
+  completions_cancel(cms);
+  completions_invalidate(cms);
+  cms->count = 0;
+  cms->sorted = 0;
+  cms->ranked = false;
+  arena_reset(cms->strings);  // keeps the blocks for the next completions
+  completions_index_clear(cms);
+}
+
+// The case-folded first 8 bytes of `s` in big-endian order, so comparing keys
+// is like comparing the folded strings up to 8 bytes (see `completion_compare`).
+static uint64_t completion_key(const char* s) {
+  uint64_t key = 0;
+  bool end = (s == NULL);
+  for (int i = 0; i < 8; i++) {
+    if (!end && s[i] == 0) { end = true; }
+    key = (key << 8) | (end ? 0 : (uint8_t)ic_tolower(s[i]));
   }
+  return key;
 }
 
-static void completions_push(completions_t* cms, const char* replacement, const char* display, const char* help, ssize_t delete_before, ssize_t delete_after) 
-{
-  if (cms->count >= cms->len) {
+// ensure there is room for `n` more completions
+static bool completions_reserve(completions_t* cms, ssize_t n) {
+  if (cms->strings == NULL) {
+    cms->strings = arena_new(cms->mem);
+    if (cms->strings == NULL) return false;
+  }
+  if (cms->count + n > cms->len) {
     ssize_t newlen = (cms->len <= 0 ? 32 : cms->len*2);
+    while (newlen < cms->count + n) { newlen *= 2; }
     completion_t* newelems = mem_realloc_tp(cms->mem, completion_t, cms->elems, newlen );
-    if (newelems == NULL) return;
+    if (newelems == NULL) return false;
     cms->elems = newelems;
     cms->len   = newlen;
   }
+  return true;
+}
+
+static bool completions_push(completions_t* cms, const char* replacement, const char* display, const char* help, ssize_t delete_before, ssize_t delete_after) 
+{
+  if (!completions_reserve(cms, 1)) return false;
   assert(cms->count < cms->len);
   completion_t* cm  = cms->elems + cms->count;
-  cm->replacement   = mem_strdup(cms->mem,replacement);
-  cm->display       = mem_strdup(cms->mem,display);
-  cm->help          = mem_strdup(cms->mem,help);
+  cm->replacement   = arena_strdup(cms->strings,replacement);
+  if (cm->replacement == NULL) return false;
+  cm->display       = arena_strdup(cms->strings,display);
+  cm->help          = arena_strdup(cms->strings,help);
   cm->delete_before = delete_before;
   cm->delete_after  = delete_after;
+  cm->len           = ic_strlen(cm->replacement);
+  cm->key           = completion_key(cm->replacement);
+  cm->width         = -1;
   cms->count++;
+  cms->sorted = 0;
+  return true;
 }
 
 ic_private ssize_t completions_count(completions_t* cms) {
@@ -102,16 +223,50 @@ static bool completions_contains(completions_t* cms, const char* replacement) {
   return false;
 } 
 
+// add a completion unless its replacement is present already
+static void completions_add_unique(completions_t* cms, bool indexed, const char* replacement, const char* display, const char* help, ssize_t delete_before, ssize_t delete_after) {
+  if (!indexed) {
+    // out of memory for the index: fall back to a linear search
+    if (!completions_contains(cms,replacement)) {
+      completions_push(cms, replacement, display, help, delete_before, delete_after);
+    }
+    return;
+  }
+  const uint32_t hash = ic_strhash(replacement);
+  cbucket_t* b = completions_index_find(cms, replacement, hash);
+  if (b->gen != cms->index_gen) {
+    if (completions_push(cms, replacement, display, help, delete_before, delete_after)) {
+      b->gen = cms->index_gen;
+      b->hash = hash;
+      b->replacement = cms->elems[cms->count - 1].replacement;
+    }
+  }
+}
+
 ic_private bool completions_add(completions_t* cms, const char* replacement, const char* display, const char* help, ssize_t delete_before, ssize_t delete_after) {
   if (cms->completer_max <= 0) return false;
   cms->completer_max--;
   //debug_msg("completion: add: %d,%d, %s\n", delete_before, delete_after, replacement);
-  if (!completions_contains(cms,replacement)) {
-    completions_push(cms, replacement, display, help, delete_before, delete_after);
-  }
+  completions_add_unique(cms, completions_index_reserve(cms, 1), replacement, display, help, delete_before, delete_after);
   return true;
 }
 
+// Add a batch of completions; the elements and the index grow once for all of them.
+// Returns false if no more completions are needed.
+ic_private bool completions_add_n(completions_t* cms, const ic_completion_t* completions, ssize_t count, ssize_t delete_before, ssize_t delete_after) {
+  if (count > cms->completer_max) { count = cms->completer_max; }
+  if (count <= 0) return (cms->completer_max > 0);
+  cms->completer_max -= count;
+  completions_reserve(cms, count);
+  const bool indexed = completions_index_reserve(cms, count);
+  for (ssize_t i = 0; i < count; i++) {
+    const ic_completion_t* cm = &completions[i];
+    if (cm->replacement == NULL) continue;
+    completions_add_unique(cms, indexed, cm->replacement, cm->display, cm->help, delete_before, delete_after);
+  }
+  return (cms->completer_max > 0);
+}
+
 static completion_t* completions_get(completions_t* cms, ssize_t index) {
   if (index < 0 || cms->count <= 0 || index >= cms->count) return NULL;
   return &cms->elems[index];
@@ -125,18 +280,35 @@ ic_private const char* completions_get_display( completions_t* cms, ssize_t inde
   return (cm->display != NULL ? cm->display : cm->replacement);
 }
 
+// Column width of the display and help of a completion. This is cached as 
+// the menu measures the entries in view on every redraw.
+ic_private ssize_t completions_get_width( completions_t* cms, ssize_t index, bbcode_t* bb ) {
+  completion_t* cm = completions_get(cms, index);
+  if (cm == NULL) return 0;
+  if (cm->width < 0) {
+    ssize_t w = bbcode_column_width(bb, (cm->display != NULL ? cm->display : cm->replacement));
+    if (cm->help != NULL) {
+      w += 2 + bbcode_column_width(bb, cm->help);
+    }
+    cm->width = w;
+  }
+  return cm->width;
+}
+
 ic_private const char* completions_get_help( completions_t* cms, ssize_t index ) {
   completion_t* cm = completions_get(cms, index);
   if (cm == NULL) return NULL;
   return cm->help;
 }
 
-ic_private const char* completions_get_hint(completions_t* cms, ssize_t index, const char** help) {
+// the rest of a completion after the deleted input (or NULL if it does not extend the input, like a fuzzy match)
+ic_private const char* completions_get_hint(completions_t* cms, ssize_t index, const char* input, ssize_t pos, const char** help) {
   if (help != NULL) { *help = NULL; }
   completion_t* cm = completions_get(cms, index);
   if (cm == NULL) return NULL;
   ssize_t len = ic_strlen(cm->replacement);
-  if (len < cm->delete_before) return NULL;
+  if (len < cm->delete_before || pos < cm->delete_before) return NULL;
+  if (ic_strnicmp(cm->replacement, input + pos - cm->delete_before, cm->delete_before) != 0) return NULL;
   const char* hint = (cm->replacement + cm->delete_before);
   if (*hint == 0 || utf8_is_cont((uint8_t)(*hint))) return NULL;  // utf8 boundary?
   if (help != NULL) { *help = cm->help; }
@@ -144,6 +316,7 @@ ic_private const char* completions_get_hint(completions_t* cms, ssize_t index, c
 }
 
 ic_private void completions_set_completer(completions_t* cms, ic_completer_fun_t* completer, void* arg) {
+  completions_invalidate(cms);
   cms->completer = completer;
   cms->completer_arg = arg;
 }
@@ -154,16 +327,58 @@ ic_private void completions_get_completer(completions_t* cms, ic_completer_fun_t
 }
 
 
+static void* completions_job_arg( completions_job_t* job );
+static completions_t* completions_job_lock( completions_job_t* job );
+static void completions_job_unlock( completions_job_t* job );
+
 ic_public void* ic_completion_arg( const ic_completion_env_t* cenv ) {
-  return (cenv == NULL ? NULL : cenv->env->completions->completer_arg);
+  if (cenv == NULL) return NULL;
+  if (cenv->job != NULL) return completions_job_arg(cenv->job);
+  return cenv->env->completions->completer_arg;
 }
 
 ic_public bool ic_has_completions( const ic_completion_env_t* cenv ) {
-  return (cenv == NULL ? false : cenv->env->completions->count > 0);
+  if (cenv == NULL) return false;
+  if (cenv->job == NULL) return (cenv->env->completions->count > 0);
+  completions_t* results = completions_job_lock(cenv->job);
+  const bool has = (results != NULL && results->count > 0);
+  completions_job_unlock(cenv->job);
+  return has;
 }
 
 ic_public bool ic_stop_completing( const ic_completion_env_t* cenv) {
-  return (cenv == NULL ? true : cenv->env->completions->completer_max <= 0);
+  if (cenv == NULL) return true;
+  if (cenv->job == NULL) return (cenv->env->completions->completer_max <= 0);
+  completions_t* results = completions_job_lock(cenv->job);  // NULL if cancelled
+  const bool stop = (results == NULL || results->completer_max <= 0);
+  completions_job_unlock(cenv->job);
+  return stop;
+}
+
+static void completions_set_monotone( completions_t* cms ) {
+  if (cms->monotone) return;
+  cms->monotone = true;
+  // generate more completions than requested so they can be refined later on
+  if (cms->completer_max > 0 && cms->completer_max < IC_MAX_COMPLETIONS_TO_SHOW) {
+    cms->completer_max = IC_MAX_COMPLETIONS_TO_SHOW;
+  }
+}
+
+ic_public void ic_set_monotone_completions( ic_completion_env_t* cenv ) {
+  if (cenv == NULL) return;
+  if (cenv->job == NULL) {
+    completions_set_monotone(cenv->env->completions);
+  }
+  else {
+    completions_t* results = completions_job_lock(cenv->job);
+    if (results != NULL) { completions_set_monotone(results); }
+    completions_job_unlock(cenv->job);
+  }
+}
+
+ic_public void ic_invalidate_completions(void) {
+  ic_env_t* env = ic_get_env(); if (env == NULL) return;
+  completions_invalidate(env->completions);
 }
 
 
@@ -189,19 +404,80 @@ ic_private ssize_t completions_apply( completions_t* cms, ssize_t index, stringb
 }
 
 
+// compare `n` case-folded bytes as unsigned (like the keys)
+static int completion_compare_folded(const char* s1, const char* s2, ssize_t n) {
+  for (ssize_t i = 0; i < n; i++) {
+    const uint8_t c1 = (uint8_t)ic_tolower(s1[i]);
+    const uint8_t c2 = (uint8_t)ic_tolower(s2[i]);
+    if (c1 != c2) return (c1 < c2 ? -1 : 1);
+  }
+  return 0;
+}
+
 static int completion_compare(const void* p1, const void* p2) {
   if (p1 == NULL || p2 == NULL) return 0;
   const completion_t* cm1 = (const completion_t*)p1;
   const completion_t* cm2 = (const completion_t*)p2;  
-  return ic_stricmp(cm1->replacement, cm2->replacement);
+  // shorter first, and then ignoring case (comparing bytes as unsigned)
+  if (cm1->len != cm2->len) return (cm1->len < cm2->len ? -1 : 1);
+  if (cm1->key != cm2->key) return (cm1->key < cm2->key ? -1 : 1);
+  if (cm1->len <= 8) return 0;
+  return completion_compare_folded(cm1->replacement + 8, cm2->replacement + 8, cm1->len - 8);
+}
+
+static void completion_swap(completion_t* elems, ssize_t i, ssize_t j) {
+  completion_t tmp = elems[i];
+  elems[i] = elems[j];
+  elems[j] = tmp;
+}
+
+// Partition `elems` such that the `k` smallest come first (with `0 < k < n`).
+static void completions_select(completion_t* elems, ssize_t n, ssize_t k) {
+  ssize_t lo = 0;
+  ssize_t hi = n - 1;
+  while (lo < hi) {
+    // median of three as the pivot
+    const ssize_t mid = lo + (hi - lo)/2;
+    if (completion_compare(&elems[mid], &elems[lo]) < 0) completion_swap(elems, mid, lo);
+    if (completion_compare(&elems[hi], &elems[lo]) < 0) completion_swap(elems, hi, lo);
+    if (completion_compare(&elems[hi], &elems[mid]) < 0) completion_swap(elems, hi, mid);
+    const completion_t pivot = elems[mid];
+    ssize_t i = lo;
+    ssize_t j = hi;
+    while (i <= j) {
+      while (completion_compare(&elems[i], &pivot) < 0) i++;
+      while (completion_compare(&elems[j], &pivot) > 0) j--;
+      if (i <= j) { completion_swap(elems, i++, j--); }
+    }
+    // now `[lo,j]` <= pivot <= `[i,hi]` (and anything in between equals the pivot)
+    if (k <= j) hi = j;
+    else if (k >= i) lo = i;
+    else break;
+  }
 }
 
-ic_private void completions_sort(completions_t* cms) {
-  if (cms->count <= 0) return;
-  qsort(cms->elems, to_size_t(cms->count), sizeof(cms->elems[0]), &completion_compare);
+// Sort such that (at least) the first `upto` completions are in order. The menu
+// only shows a few at a time so we select those first and sort the rest on demand.
+ic_private void completions_sort(completions_t* cms, ssize_t upto) {
+  if (cms->ranked) return;
+  if (upto > cms->count) upto = cms->count;
+  if (upto <= cms->sorted) return;
+  completion_t* elems = cms->elems + cms->sorted;
+  const ssize_t n = cms->count - cms->sorted;
+  const ssize_t k = upto - cms->sorted;
+  if (k < n) { completions_select(elems, n, k); }
+  qsort(elems, to_size_t(k), sizeof(elems[0]), &completion_compare);
+  cms->sorted = upto;
 }
 
-#define IC_MAX_PREFIX  (256)
+// Length of the longest common prefix of `s` and `t`, backed up to a UTF-8 character boundary.
+static ssize_t completion_common_prefix(const char* s, const char* t) {
+  ssize_t n = 0;
+  while (s[n] != 0 && s[n] == t[n]) { n++; }
+  // do not split a multi-byte character
+  while (n > 0 && (((uint8_t)s[n] & 0xC0) == 0x80 || ((uint8_t)t[n] & 0xC0) == 0x80)) { n--; }
+  return n;
+}
 
 // find longest common prefix and complete with that.
 ic_private ssize_t completions_apply_longest_prefix(completions_t* cms, stringbuf_t* sbuf, ssize_t pos) {
@@ -209,35 +485,30 @@ ic_private ssize_t completions_apply_longest_prefix(completions_t* cms, stringbu
     return completions_apply(cms,0,sbuf,pos);
   }
 
-  // set initial prefix to the first entry
+  // the common prefix of a set of strings is the common prefix of its (byte-wise) 
+  // smallest and largest elements; find those in one pass over the completions
   completion_t* cm = completions_get(cms, 0);
   if (cm == NULL) return -1;
-
-  char prefix[IC_MAX_PREFIX+1];
-  ssize_t delete_before = cm->delete_before;
-  ic_strncpy( prefix, IC_MAX_PREFIX+1, cm->replacement, IC_MAX_PREFIX );
-  prefix[IC_MAX_PREFIX] = 0;
-  
-  // and visit all others to find the longest common prefix
+  const ssize_t delete_before = cm->delete_before;
+  const char* lo = cm->replacement;
+  const char* hi = cm->replacement;
   for(ssize_t i = 1; i < cms->count; i++) {
     cm = completions_get(cms,i);
-    if (cm->delete_before != delete_before) {  // deletions must match delete_before
-      prefix[0] = 0;
-      break;
-    }
-    // check if it is still a prefix
-    const char* r = cm->replacement;    
-    ssize_t j;
-    for(j = 0; prefix[j] != 0 && r[j] != 0; j++) {
-      if (prefix[j] != r[j]) break;
-    }
-    prefix[j] = 0;
-    if (j <= 0) break;
+    if (cm->delete_before != delete_before) return -1;  // deletions must match delete_before
+    const char* r = cm->replacement;
+    if (strcmp(r, lo) < 0) { lo = r; }
+    else if (strcmp(r, hi) > 0) { hi = r; }
   }
+  const ssize_t len = completion_common_prefix(lo, hi);
 
   // check the length
-  ssize_t len = ic_strlen(prefix);
   if (len <= 0 || len < delete_before) return -1;
+  if (cms->ranked) {
+    // fuzzy matches only complete a prefix that extends the input
+    if (delete_before > pos || ic_strnicmp(lo, sbuf_string(sbuf) + pos - delete_before, delete_before) != 0) return -1;
+  }
+  char* prefix = mem_strndup(cms->mem, lo, len);
+  if (prefix == NULL) return -1;
 
   // we found a prefix :-)
   completion_t cprefix;
@@ -245,9 +516,11 @@ ic_private ssize_t completions_apply_longest_prefix(completions_t* cms, stringbu
   cprefix.delete_before = delete_before;
   cprefix.replacement   = prefix;
   ssize_t newpos = completion_apply( &cprefix, sbuf, pos);
+  mem_free(cms->mem, prefix);
   if (newpos < 0) return newpos;  
 
   // adjust all delete_before for the new replacement
+  completions_invalidate(cms);
   for( ssize_t i = 0; i < cms->count; i++) {
     cm = completions_get(cms,i);
     cm->delete_before = len;
@@ -270,6 +543,57 @@ ic_public bool ic_add_completions(ic_completion_env_t* cenv, const char* prefix,
   return true;
 }
 
+// best fuzzy matches first
+static int fuzzy_match_compare(const void* p1, const void* p2) {
+  const fuzzy_match_t* m1 = (const fuzzy_match_t*)p1;
+  const fuzzy_match_t* m2 = (const fuzzy_match_t*)p2;
+  if (m1->score != m2->score) return (m1->score > m2->score ? -1 : 1);
+  return (m1->tie > m2->tie ? -1 : (m1->tie < m2->tie ? 1 : 0));
+}
+
+// Mark the completions as ranked and return how many can still be added.
+static ssize_t completions_start_ranked( ic_completion_env_t* cenv ) {
+  if (cenv->job == NULL) {
+    completions_t* cms = cenv->env->completions;
+    cms->ranked = true;
+    return cms->completer_max;
+  }
+  completions_t* results = completions_job_lock(cenv->job);
+  ssize_t max = 0;
+  if (results != NULL) {
+    results->ranked = true;
+    max = results->completer_max;
+  }
+  completions_job_unlock(cenv->job);
+  return max;
+}
+
+ic_public bool ic_add_completions_fuzzy(ic_completion_env_t* cenv, const char* prefix, const char** completions) {
+  if (cenv == NULL || prefix == NULL || completions == NULL) return true;
+  const ssize_t max = completions_start_ranked(cenv);
+  if (max <= 0) return false;
+  const ssize_t prefix_len = ic_strlen(prefix);
+  fuzzy_match_t* heap = mem_malloc_tp_n(cenv->env->mem, fuzzy_match_t, max);
+  if (heap == NULL) return false;
+  // keep the best `max` matches; on equal scores the earlier completion is better
+  ssize_t count = 0;
+  for (ssize_t i = 0; completions[i] != NULL; i++) {
+    const char* s = completions[i];
+    const ssize_t len = ic_strlen(s);
+    if (len < prefix_len) continue;
+    const int score = fuzzy_score(prefix, prefix_len, s, len, NULL);
+    if (score >= 0) { fuzzy_top_push(heap, &count, max, score, -i); }
+  }
+  // and add them from best to worst
+  qsort(heap, to_size_t(count), sizeof(heap[0]), &fuzzy_match_compare);
+  bool cont = true;
+  for (ssize_t i = 0; i < count && cont; i++) {
+    cont = ic_add_completion_ex(cenv, completions[-heap[i].tie], NULL, NULL);
+  }
+  mem_free(cenv->env->mem, heap);
+  return cont;
+}
+
 ic_public bool ic_add_completion(ic_completion_env_t* cenv, const char* replacement) {
   return ic_add_completion_ex(cenv, replacement, NULL, NULL);
 }
@@ -282,17 +606,75 @@ ic_public bool ic_add_completion_prim(ic_completion_env_t* cenv, const char* rep
   return (*cenv->complete)(cenv->env, cenv->closure, replacement, display, help, delete_before, delete_after );
 }
 
+ic_public bool ic_add_completions_n(ic_completion_env_t* cenv, const ic_completion_t* completions, long count) {
+  if (cenv == NULL || completions == NULL || count <= 0) return !ic_stop_completing(cenv);
+  if (cenv->complete_n != NULL) {
+    return (*cenv->complete_n)(cenv->env, cenv->closure, completions, count, 0, 0);
+  }
+  // a transformer needs to see each completion
+  for (long i = 0; i < count; i++) {
+    if (completions[i].replacement == NULL) continue;
+    if (!ic_add_completion_ex(cenv, completions[i].replacement, completions[i].display, completions[i].help)) return false;
+  }
+  return true;
+}
+
 static bool prim_add_completion(ic_env_t* env, void* funenv, const char* replacement, const char* display, const char* help, long delete_before, long delete_after) {
   ic_unused(funenv);
   return completions_add(env->completions, replacement, display, help, delete_before, delete_after);
 }
 
+static bool prim_add_completions_n(ic_env_t* env, void* funenv, const ic_completion_t* completions, long count, long delete_before, long delete_after) {
+  ic_unused(funenv);
+  return completions_add_n(env->completions, completions, count, delete_before, delete_after);
+}
+
 ic_public void ic_set_default_completer(ic_completer_fun_t* completer, void* arg) {
   ic_env_t* env = ic_get_env(); if (env == NULL) return;
   completions_set_completer(env->completions, completer, arg);
 }
 
+// Refine the cached completions if the input only extends them at the cursor.
+// A completion stays if its replacement starts with the (now longer) input it replaces.
+static bool completions_refine(completions_t* cms, const char* input, ssize_t pos) {
+  if (cms->cache_input == NULL || !cms->cache_complete) return false;
+  const ssize_t extra = pos - cms->cache_pos;
+  if (extra < 0 || strncmp(input, cms->cache_input, to_size_t(cms->cache_pos)) != 0 ||
+      strcmp(input + pos, cms->cache_input + cms->cache_pos) != 0) return false;
+  if (extra == 0) return true;  // unchanged
+  char* cache_input = mem_strdup(cms->mem, input);
+  if (cache_input == NULL) return false;
+  cache_input[pos] = 0;  // so `cache_input + pos - delete_before` is the text a completion replaces
+  ssize_t n = 0;
+  ssize_t sorted = 0;
+  for( ssize_t i = 0; i < cms->count; i++) {
+    completion_t* cm = cms->elems + i;
+    const ssize_t delete_before = cm->delete_before + extra;
+    if (delete_before > pos || !ic_istarts_with(cm->replacement, cache_input + pos - delete_before)) continue;
+    cms->elems[n] = *cm;
+    cms->elems[n].delete_before = delete_before;
+    n++;
+    if (i < cms->sorted) { sorted = n; }  // filtering keeps the order
+  }
+  if (n == 0) {
+    // maybe a new word was started: ask the completer again
+    mem_free(cms->mem, cache_input);
+    return false;
+  }
+  ic_strcpy(cache_input + pos, ic_strlen(input + pos) + 1, input + pos);
+  cms->count = n;
+  cms->sorted = sorted;
+  completions_index_rebuild(cms);
+  mem_free(cms->mem, cms->cache_input);
+  cms->cache_input = cache_input;
+  cms->cache_pos = pos;
+  return true;
+}
+
 ic_private ssize_t completions_generate(struct ic_env_s* env, completions_t* cms, const char* input, ssize_t pos, ssize_t max) {
+  if (input != NULL && ic_strlen(input) >= pos && completions_refine(cms, input, pos)) {
+    return (cms->count < max ? cms->count : max);
+  }
   completions_clear(cms);
   if (cms->completer == NULL || input == NULL || ic_strlen(input) < pos) return 0;
 
@@ -303,18 +685,264 @@ ic_private ssize_t completions_generate(struct ic_env_s* env, completions_t* cms
   cenv.cursor = (long)pos;
   cenv.arg = cms->completer_arg;
   cenv.complete = &prim_add_completion;
+  cenv.complete_n = &prim_add_completions_n;
   cenv.closure  = NULL;
+  cenv.job      = NULL;
   const char* prefix = mem_strndup(cms->mem, input, pos);
   cms->completer_max = max;
+  cms->monotone = false;
   
-  // and complete
+  // and complete (after cancelled background completers returned)
+  completions_reap(cms, true);
   cms->completer(&cenv,prefix);
 
   // restore
   mem_free(cms->mem,prefix);
-  return completions_count(cms);
+
+  // and remember monotone completions for refinement
+  if (cms->monotone) {
+    cms->cache_input = mem_strdup(cms->mem, input);
+    cms->cache_pos = pos;
+    cms->cache_complete = (cms->completer_max > 0);
+  }
+  const ssize_t count = completions_count(cms);
+  return (count < max ? count : max);
+}
+
+
+//-------------------------------------------------------------
+// Background completion
+//
+// The completer runs on a worker thread and adds its completions
+// to a separate set that the editor copies from as they arrive.
+// Cancelled jobs are kept until their completer returns; a new
+// completion waits for those first so a completer never runs on
+// two threads at once.
+//-------------------------------------------------------------
+
+struct completions_job_s {
+  completions_job_t* next;     // next cancelled job
+  ic_env_t*     env;
+  completions_t* results;      // completions added so far (guarded by `lock`)
+  ic_completer_fun_t* completer;
+  void*         completer_arg;
+  char*         input;
+  ssize_t       pos;
+  ssize_t       taken;         // number of results copied already (only used by the editor)
+  int64_t       deadline;      // cancel at this time (or 0 for none)
+  bool          cancelled;     // guarded by `lock`
+  bool          done;          // guarded by `lock`
+  ic_mutex_t*   lock;
+  ic_thread_t*  thread;
+};
+
+#if defined(IC_NO_THREADS)
+
+static void* completions_job_arg( completions_job_t* job ) { ic_unused(job); return NULL; }
+static completions_t* completions_job_lock( completions_job_t* job ) { ic_unused(job); return NULL; }
+static void completions_job_unlock( completions_job_t* job ) { ic_unused(job); }
+static void completions_reap(completions_t* cms, bool wait) { ic_unused(cms); ic_unused(wait); }
+
+ic_private bool completions_start(struct ic_env_s* env, completions_t* cms, const char* input, ssize_t pos, ssize_t max, long deadline_ms) {
+  ic_unused(env); ic_unused(cms); ic_unused(input); ic_unused(pos); ic_unused(max); ic_unused(deadline_ms);
+  return false;  // generate synchronously instead
+}
+
+ic_private bool completions_poll(completions_t* cms) { ic_unused(cms); return false; }
+ic_private bool completions_pending(completions_t* cms) { ic_unused(cms); return false; }
+ic_private void completions_cancel(completions_t* cms) { ic_unused(cms); }
+
+#else
+
+// monotonic time in milliseconds
+static int64_t completions_msecs(void) {
+  #if defined(_WIN32)
+  return (int64_t)GetTickCount64();
+  #else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000 + (int64_t)ts.tv_nsec / 1000000);
+  #endif
+}
+
+static void* completions_job_arg( completions_job_t* job ) {
+  return job->completer_arg;  // constant while the job runs
+}
+
+// lock the job and return its results (or NULL if it was cancelled)
+static completions_t* completions_job_lock( completions_job_t* job ) {
+  mutex_lock(job->lock);
+  return (job->cancelled ? NULL : job->results);
+}
+
+static void completions_job_unlock( completions_job_t* job ) {
+  mutex_unlock(job->lock);
+}
+
+static bool job_add_completion(ic_env_t* env, void* funenv, const char* replacement, const char* display, const char* help, long delete_before, long delete_after) {
+  ic_unused(env);
+  completions_job_t* job = (completions_job_t*)funenv;
+  completions_t* results = completions_job_lock(job);
+  const bool cont = (results != NULL && completions_add(results, replacement, display, help, delete_before, delete_after));
+  completions_job_unlock(job);
+  return cont;
+}
+
+static bool job_add_completions_n(ic_env_t* env, void* funenv, const ic_completion_t* completions, long count, long delete_before, long delete_after) {
+  ic_unused(env);
+  completions_job_t* job = (completions_job_t*)funenv;
+  completions_t* results = completions_job_lock(job);
+  const bool cont = (results != NULL && completions_add_n(results, completions, count, delete_before, delete_after));
+  completions_job_unlock(job);
+  return cont;
+}
+
+static void completions_job_run( void* arg ) {
+  completions_job_t* job = (completions_job_t*)arg;
+  ic_completion_env_t cenv;
+  cenv.env = job->env;
+  cenv.input = job->input;
+  cenv.cursor = (long)job->pos;
+  cenv.arg = job->completer_arg;
+  cenv.complete = &job_add_completion;
+  cenv.complete_n = &job_add_completions_n;
+  cenv.closure = job;
+  cenv.job = job;
+  char* prefix = mem_strndup(job->env->mem, job->input, job->pos);
+  if (prefix != NULL) {
+    (*job->completer)(&cenv, prefix);
+    mem_free(job->env->mem, prefix);
+  }
+  mutex_lock(job->lock);
+  job->done = true;
+  mutex_unlock(job->lock);
+}
+
+static void completions_job_join( completions_t* cms, completions_job_t* job ) {
+  thread_join(cms->mem, job->thread);
+  job->thread = NULL;
+}
+
+static void completions_job_free( completions_t* cms, completions_job_t* job ) {
+  mutex_free(cms->mem, job->lock);
+  completions_free(job->results);
+  mem_free(cms->mem, job->input);
+  mem_free(cms->mem, job);
+}
+
+static bool completions_job_done( completions_job_t* job ) {
+  mutex_lock(job->lock);
+  const bool done = job->done;
+  mutex_unlock(job->lock);
+  return done;
+}
+
+// free cancelled jobs that finished (or wait for all of them)
+static void completions_reap(completions_t* cms, bool wait) {
+  completions_job_t** prev = &cms->cancelled;
+  while (*prev != NULL) {
+    completions_job_t* job = *prev;
+    if (wait || completions_job_done(job)) {
+      *prev = job->next;
+      completions_job_join(cms, job);
+      completions_job_free(cms, job);
+    }
+    else {
+      prev = &job->next;
+    }
+  }
+}
+
+// Start generating completions in the background; these are added to the completions
+// by `completions_poll`. Returns false if no thread could be started.
+ic_private bool completions_start(struct ic_env_s* env, completions_t* cms, const char* input, ssize_t pos, ssize_t max, long deadline_ms) {
+  completions_cancel(cms);
+  if (input == NULL || ic_strlen(input) < pos) { completions_clear(cms); return true; }
+  if (completions_refine(cms, input, pos)) return true;  // nothing to wait for
+  completions_clear(cms);
+  if (cms->completer == NULL) return true;
+  completions_reap(cms, true);  // wait for cancelled completers to return
+  completions_job_t* job = mem_zalloc_tp(cms->mem, completions_job_t);
+  if (job == NULL) return false;
+  job->env = env;
+  job->results = completions_new(cms->mem);
+  job->input = mem_strdup(cms->mem, input);
+  job->pos = pos;
+  job->completer = cms->completer;
+  job->completer_arg = cms->completer_arg;
+  job->deadline = (deadline_ms > 0 ? completions_msecs() + deadline_ms : 0);
+  if (job->results == NULL || job->input == NULL) {
+    completions_free(job->results);
+    mem_free(cms->mem, job->input);
+    mem_free(cms->mem, job);
+    return false;
+  }
+  job->results->completer_max = max;
+  job->lock = mutex_new(cms->mem);
+  if (job->lock != NULL) { job->thread = thread_start(cms->mem, &completions_job_run, job); }
+  if (job->thread == NULL) {
+    completions_job_free(cms, job);
+    return false;
+  }
+  cms->job = job;
+  cms->completer_max = max;  // for the copies
+  return true;
+}
+
+// Copy the completions that arrived from the background; returns true if there were any.
+// Once the completer is done (or the deadline passed) the completions are no longer pending.
+ic_private bool completions_poll(completions_t* cms) {
+  completions_reap(cms, false);
+  completions_job_t* job = cms->job;
+  if (job == NULL) return false;
+  mutex_lock(job->lock);
+  const ssize_t count = cms->count;
+  for( ; job->taken < job->results->count; job->taken++) {
+    const completion_t* cm = &job->results->elems[job->taken];
+    completions_add(cms, cm->replacement, cm->display, cm->help, cm->delete_before, cm->delete_after);
+  }
+  if (job->results->ranked) { cms->ranked = true; }
+  const bool done = job->done;
+  const bool cache = (done && job->results->monotone);
+  mutex_unlock(job->lock);
+  if (done) {
+    cms->job = NULL;
+    completions_job_join(cms, job);
+    if (cache) {
+      // keep monotone completions for refinement
+      cms->cache_input = job->input;
+      cms->cache_pos = job->pos;
+      cms->cache_complete = (job->results->completer_max > 0);
+      job->input = NULL;
+    }
+    completions_job_free(cms, job);
+  }
+  else if (job->deadline > 0 && completions_msecs() >= job->deadline) {
+    completions_cancel(cms);  // use the partial results
+  }
+  return (cms->count > count);
+}
+
+ic_private bool completions_pending(completions_t* cms) {
+  return (cms->job != NULL);
 }
 
+// Cancel the background completion; its completer sees `ic_stop_completing` return true.
+ic_private void completions_cancel(completions_t* cms) {
+  completions_job_t* job = cms->job;
+  if (job != NULL) {
+    mutex_lock(job->lock);
+    job->cancelled = true;
+    mutex_unlock(job->lock);
+    cms->job = NULL;
+    job->next = cms->cancelled;
+    cms->cancelled = job;
+  }
+  completions_reap(cms, false);
+}
+
+#endif
+
 // The default completer is no completion is set
 static void default_filename_completer( ic_completion_env_t* cenv, const char* prefix ) {
   #ifdef _WIN32
@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "stringbuf.h"
+#include "bbcode.h"
 
 
 //-------------------------------------------------------------
@@ -17,28 +18,49 @@
 //-------------------------------------------------------------
 #define IC_MAX_COMPLETIONS_TO_SHOW  (1000)
 #define IC_MAX_COMPLETIONS_TO_TRY   (IC_MAX_COMPLETIONS_TO_SHOW/4)
+#define IC_MAX_COMPLETIONS_TO_LIST  (100000) // in the scrollable list of all completions
+#define IC_ASYNC_POLL_MS            (20)   // check for asynchronous completions this often
 
 typedef struct completions_s completions_t;
+typedef struct completions_job_s completions_job_t;
 
 ic_private completions_t* completions_new(alloc_t* mem);
 ic_private void        completions_free(completions_t* cms);
 ic_private void        completions_clear(completions_t* cms);
+ic_private void        completions_invalidate(completions_t* cms);
+ic_private bool        completions_start(struct ic_env_s* env, completions_t* cms, const char* input, ssize_t pos, ssize_t max, long deadline_ms);
+ic_private bool        completions_poll(completions_t* cms);
+ic_private bool        completions_pending(completions_t* cms);
+ic_private void        completions_cancel(completions_t* cms);
 ic_private bool        completions_add(completions_t* cms , const char* replacement, const char* display, const char* help, ssize_t delete_before, ssize_t delete_after);
+ic_private bool        completions_add_n(completions_t* cms, const ic_completion_t* completions, ssize_t count, ssize_t delete_before, ssize_t delete_after);
 ic_private ssize_t     completions_count(completions_t* cms);
 ic_private ssize_t     completions_generate(struct ic_env_s* env, completions_t* cms , const char* input, ssize_t pos, ssize_t max);
-ic_private void        completions_sort(completions_t* cms);
+ic_private void        completions_sort(completions_t* cms, ssize_t upto);
 ic_private void        completions_set_completer(completions_t* cms, ic_completer_fun_t* completer, void* arg);
 ic_private const char* completions_get_display(completions_t* cms , ssize_t index, const char** help);
-ic_private const char* completions_get_hint(completions_t* cms, ssize_t index, const char** help);
+ic_private ssize_t     completions_get_width(completions_t* cms, ssize_t index, bbcode_t* bb);
+ic_private const char* completions_get_hint(completions_t* cms, ssize_t index, const char* input, ssize_t pos, const char** help);
 ic_private void        completions_get_completer(completions_t* cms, ic_completer_fun_t** completer, void** arg);
 
 ic_private ssize_t     completions_apply(completions_t* cms, ssize_t index, stringbuf_t* sbuf, ssize_t pos);
 ic_private ssize_t     completions_apply_longest_prefix(completions_t* cms, stringbuf_t* sbuf, ssize_t pos);
 
+//-------------------------------------------------------------
+// Cached directory listings for file name completion
+//-------------------------------------------------------------
+typedef struct dircache_s dircache_t;
+
+ic_private dircache_t* dircache_new(alloc_t* mem);
+ic_private void        dircache_free(dircache_t* dc);
+ic_private bool        dircache_enable(dircache_t* dc, bool enable);
+ic_private ssize_t     dircache_set_max(dircache_t* dc, ssize_t max);
+
 //-------------------------------------------------------------
 // Completion environment
 //-------------------------------------------------------------
 typedef bool (ic_completion_fun_t)( ic_env_t* env, void* funenv, const char* replacement, const char* display, const char* help, long delete_before, long delete_after );
+typedef bool (ic_completions_fun_t)( ic_env_t* env, void* funenv, const ic_completion_t* completions, long count, long delete_before, long delete_after );
 
 struct ic_completion_env_s {
   ic_env_t*   env;       // the isocline environment
@@ -47,6 +69,8 @@ struct ic_completion_env_s {
   void*       arg;       // argument given to `ic_set_completer`
   void*       closure;   // free variables for function composition
   ic_completion_fun_t* complete;  // function that adds a completion
+  ic_completions_fun_t* complete_n; // function that adds many completions at once (NULL if each must pass `complete`)
+  completions_job_t* job;  // background completion this runs in (NULL if on the editor thread)
 };
 
 #endif // IC_COMPLETIONS_H
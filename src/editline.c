@@ -6,6 +6,7 @@
 -----------------------------------------------------------------------------*/
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "term.h"
@@ -16,6 +17,8 @@
 #include "completions.h"
 #include "undo.h"
 #include "highlight.h"
+#include "fuzzy.h"
+#include "screen.h"
 
 //-------------------------------------------------------------
 // The editor state
@@ -29,6 +32,7 @@ typedef struct editor_s {
   stringbuf_t*  extra;        // extra displayed info (for completion menu etc)
   stringbuf_t*  hint;         // hint displayed as part of the input
   stringbuf_t*  hint_help;    // help for a hint.
+  bool          hint_history; // is the hint the rest of a history entry?
   ssize_t       pos;          // current cursor position in the input
   ssize_t       cur_rows;     // current used rows to display our content (including extra content)
   ssize_t       cur_row;      // current row that has the cursor (0 based, relative to the prompt)
@@ -43,6 +47,9 @@ typedef struct editor_s {
   // caches
   attrbuf_t*    attrs;        // reuse attribute buffers 
   attrbuf_t*    attrs_extra; 
+  stringbuf_t*  prompt;       // rendered prompt for a row
+  attrbuf_t*    attrs_prompt;
+  screen_t*     screen;       // rows as currently displayed
 } editor_t;
 
 
@@ -163,26 +170,29 @@ static bool edit_pos_is_at_row_end( ic_env_t* env, editor_t* eb ) {
   return rc.last_on_row;
 }
 
-static void edit_write_prompt( ic_env_t* env, editor_t* eb, ssize_t row, bool in_extra ) {
+// append the prompt of a row to the screen
+static void edit_append_prompt( ic_env_t* env, editor_t* eb, ssize_t row, bool in_extra, attr_t attr ) {
   if (in_extra) return;
-  bbcode_style_open(env->bbcode, "ic-prompt");
+  const attr_t pattr = attr_update_with(attr, bbcode_style(env->bbcode, "ic-prompt"));
   if (row==0) {
-    // regular prompt text    
-    bbcode_print( env->bbcode, eb->prompt_text );
+    // regular prompt text
+    bbcode_append(env->bbcode, eb->prompt_text, eb->prompt, eb->attrs_prompt);
   }
   else if (!env->no_multiline_indent) {
     // multiline continuation indentation
     // todo: cache prompt widths
     ssize_t textw = bbcode_column_width(env->bbcode, eb->prompt_text );
     ssize_t markerw = bbcode_column_width(env->bbcode, env->prompt_marker);
-    ssize_t cmarkerw = bbcode_column_width(env->bbcode, env->cprompt_marker);      
-    if (cmarkerw < markerw + textw) {
-      term_write_repeat(env->term, " ", markerw + textw - cmarkerw );
+    ssize_t cmarkerw = bbcode_column_width(env->bbcode, env->cprompt_marker);
+    for (ssize_t i = cmarkerw; i < markerw + textw; i++) {
+      attrbuf_append_n(eb->prompt, eb->attrs_prompt, " ", 1, attr_none());
     }
   }
   // the marker
-  bbcode_print(env->bbcode, (row == 0 ? env->prompt_marker : env->cprompt_marker ));   
-  bbcode_style_close(env->bbcode,NULL);    
+  bbcode_append(env->bbcode, (row == 0 ? env->prompt_marker : env->cprompt_marker), eb->prompt, eb->attrs_prompt);
+  screen_append(eb->screen, sbuf_string(eb->prompt), sbuf_len(eb->prompt), attrbuf_attrs(eb->attrs_prompt, sbuf_len(eb->prompt)), pattr);
+  sbuf_clear(eb->prompt);
+  attrbuf_clear(eb->attrs_prompt);
 }
 
 //-------------------------------------------------------------
@@ -194,6 +204,7 @@ typedef struct refresh_info_s {
   editor_t*   eb;
   attrbuf_t*  attrs;
   bool        in_extra;
+  attr_t      attr;
   ssize_t     first_row;
   ssize_t     last_row;
 } refresh_info_t;
@@ -205,37 +216,35 @@ static bool edit_refresh_rows_iter(
 {
   ic_unused(res); ic_unused(startw);
   const refresh_info_t* info = (const refresh_info_t*)(arg);
-  term_t* term = info->env->term;
+  editor_t* eb = info->eb;
 
   // debug_msg("edit: line refresh: row %zd, len: %zd\n", row, row_len);
   if (row < info->first_row) return false;
   if (row > info->last_row)  return true; // should not occur
   
-  // term_clear_line(term);
-  edit_write_prompt(info->env, info->eb, row, info->in_extra);
+  edit_append_prompt(info->env, eb, row, info->in_extra, info->attr);
 
-  //' write output
+  // the row contents
   if (info->attrs == NULL || (info->env->no_highlight && info->env->no_bracematch)) {
-    term_write_n( term, s + row_start, row_len );
+    screen_append( eb->screen, s + row_start, row_len, NULL, info->attr );
   }
   else {
-    term_write_formatted_n( term, s + row_start, attrbuf_attrs(info->attrs, row_start + row_len) + row_start, row_len );
+    screen_append( eb->screen, s + row_start, row_len, attrbuf_attrs(info->attrs, row_start + row_len) + row_start, info->attr );
   }
 
-  // write line ending
+  // and the line ending
   if (row < info->last_row) {
     if (is_wrap && tty_is_utf8(info->env->tty)) {       
       #ifndef __APPLE__
-      bbcode_print( info->env->bbcode, "[ic-dim]\xE2\x86\x90");  // left arrow 
+      bbcode_append( info->env->bbcode, "[ic-dim]\xE2\x86\x90", eb->prompt, eb->attrs_prompt);  // left arrow 
       #else
-      bbcode_print( info->env->bbcode, "[ic-dim]\xE2\x86\xB5" ); // return symbol
+      bbcode_append( info->env->bbcode, "[ic-dim]\xE2\x86\xB5", eb->prompt, eb->attrs_prompt); // return symbol
       #endif
+      screen_append(eb->screen, sbuf_string(eb->prompt), sbuf_len(eb->prompt), attrbuf_attrs(eb->attrs_prompt, sbuf_len(eb->prompt)), info->attr);
+      sbuf_clear(eb->prompt);
+      attrbuf_clear(eb->attrs_prompt);
     }
-    term_clear_to_end_of_line(term);
-    term_writeln(term, "");
-  }
-  else {
-    term_clear_to_end_of_line(term);
+    screen_newline(eb->screen);
   }
   return (row >= info->last_row);  
 }
@@ -250,6 +259,7 @@ static void edit_refresh_rows(ic_env_t* env, editor_t* eb, stringbuf_t* input, a
   info.eb         = eb;
   info.attrs      = attrs;
   info.in_extra   = in_extra;
+  info.attr       = term_get_attr(env->term);
   info.first_row  = first_row;
   info.last_row   = last_row;
   sbuf_for_each_row( input, eb->termw, promptw, cpromptw, &edit_refresh_rows_iter, &info, NULL);
@@ -315,15 +325,8 @@ static void edit_refresh(ic_env_t* env, editor_t* eb)
   }
   assert(last_row - first_row < termh);
   
-  // reduce flicker
-  buffer_mode_t bmode = term_set_buffer_mode(env->term, BUFFERED);        
-
-  // back up to the first line
-  term_start_of_line(env->term);
-  term_up(env->term, (eb->cur_row >= termh ? termh-1 : eb->cur_row) );
-  // term_clear_lines_to_end(env->term);  // gives flicker in old Windows cmd prompt 
-
-  // render rows
+  // build the visible rows
+  screen_begin(eb->screen, eb->termw, termh);
   edit_refresh_rows( env, eb, eb->input, eb->attrs, promptw, cpromptw, false, first_row, last_row );  
   if (rows_extra > 0) {
     assert(extra != NULL);
@@ -331,23 +334,15 @@ static void edit_refresh(ic_env_t* env, editor_t* eb)
     const ssize_t last_rowx = last_row - rows_input; assert(last_rowx >= 0);
     edit_refresh_rows(env, eb, extra, eb->attrs_extra, 0, 0, true, first_rowx, last_rowx);
   }
-    
-  // overwrite trailing rows we do not use anymore  
-  ssize_t rrows = last_row - first_row + 1;  // rendered rows
-  if (rrows < termh && rows < eb->cur_rows) {
-    ssize_t clear = eb->cur_rows - rows;
-    while (rrows < termh && clear > 0) {
-      clear--;
-      rrows++;
-      term_writeln(env->term,"");
-      term_clear_line(env->term);
-    }
-  }
-  
-  // move cursor back to edit position
-  term_start_of_line(env->term);
-  term_up(env->term, first_row + rrows - 1 - rc.row );
-  term_right(env->term, rc.col + (rc.row == 0 ? promptw : cpromptw));
+
+  // reduce flicker
+  buffer_mode_t bmode = term_set_buffer_mode(env->term, BUFFERED);        
+
+  // write the rows that changed and move the cursor to the edit position;
+  // when redrawing everything we back up from the previous cursor row and overwrite trailing rows we do not use anymore
+  if (env->no_incremental_refresh) { screen_invalidate(eb->screen); }
+  screen_render(eb->screen, rc.row - first_row, rc.col + (rc.row == 0 ? promptw : cpromptw),
+                (eb->cur_row >= termh ? termh-1 : eb->cur_row), (eb->cur_rows < termh ? eb->cur_rows : termh));
 
   // and refresh
   term_flush(env->term);
@@ -380,6 +375,7 @@ static void edit_clear(ic_env_t* env, editor_t* eb ) {
   
   // move cursor back 
   term_up(env->term, eb->cur_rows - eb->cur_row );  
+  screen_invalidate(eb->screen);
 }
 
 
@@ -432,6 +428,7 @@ static bool edit_resize(ic_env_t* env, editor_t* eb ) {
     eb->cur_rows = rows;
   }
   eb->termw = newtermw;     
+  screen_invalidate(eb->screen);  // the terminal reflowed the rows
   edit_refresh(env,eb); 
 
   // remove hint again
@@ -449,6 +446,8 @@ static void editor_append_hint_help(editor_t* eb, const char* help) {
   }
 }
 
+static bool edit_history_hint(ic_env_t* env, editor_t* eb);
+
 // refresh with possible hint
 static void edit_refresh_hint(ic_env_t* env, editor_t* eb) {
   if (env->no_hint || env->hint_delay > 0) {
@@ -458,15 +457,23 @@ static void edit_refresh_hint(ic_env_t* env, editor_t* eb) {
   }
     
   // and see if we can construct a hint (displayed after a delay)
-  ssize_t count = completions_generate(env, env->completions, sbuf_string(eb->input), eb->pos, 2);
+  eb->hint_history = false;
+  ssize_t count;
+  if (env->complete_async && completions_start(env, env->completions, sbuf_string(eb->input), eb->pos, 2, 0 /* no deadline */)) {
+    // a background completer updates the hint once it is done (in `edit_read_key`)
+    count = (completions_pending(env->completions) ? 0 : completions_count(env->completions));
+  }
+  else {
+    count = completions_generate(env, env->completions, sbuf_string(eb->input), eb->pos, 2);
+  }
   if (count == 1) {
     const char* help = NULL;
-    const char* hint = completions_get_hint(env->completions, 0, &help);
+    const char* hint = completions_get_hint(env->completions, 0, sbuf_string(eb->input), eb->pos, &help);
     if (hint != NULL) {
       sbuf_replace(eb->hint, hint); 
       editor_append_hint_help(eb, help);
-      // do auto-tabbing?
-      if (env->complete_autotab) {
+      // do auto-tabbing? (not with a background completer as that would block)
+      if (env->complete_autotab && !env->complete_async) {
         stringbuf_t* sb = sbuf_new(env->mem);  // temporary buffer for completion
         if (sb != NULL) { 
           sbuf_replace( sb, sbuf_string(eb->input) ); 
@@ -479,7 +486,7 @@ static void edit_refresh_hint(ic_env_t* env, editor_t* eb) {
             count = completions_generate(env, env->completions, sbuf_string(sb), pos, 2);
             if (count == 1) {
               const char* extra_help = NULL;
-              extra_hint = completions_get_hint(env->completions, 0, &extra_help);
+              extra_hint = completions_get_hint(env->completions, 0, sbuf_string(sb), pos, &extra_help);
               if (extra_hint != NULL) {
                 editor_append_hint_help(eb, extra_help);
                 sbuf_append(eb->hint, extra_hint);
@@ -492,6 +499,10 @@ static void edit_refresh_hint(ic_env_t* env, editor_t* eb) {
       }      
     }
   }
+  // otherwise the latest history entry that starts with the input
+  if (sbuf_len(eb->hint) == 0) {
+    eb->hint_history = edit_history_hint(env, eb);
+  }
 
   if (env->hint_delay <= 0) {
     // refresh with hint directly
@@ -499,6 +510,68 @@ static void edit_refresh_hint(ic_env_t* env, editor_t* eb) {
   }
 }
 
+// poll a background completer for a hint; returns true if the hint changed
+static bool edit_async_hint(ic_env_t* env, editor_t* eb) {
+  completions_poll(env->completions);
+  if (completions_pending(env->completions) || completions_count(env->completions) != 1) return false;
+  const char* help = NULL;
+  const char* hint = completions_get_hint(env->completions, 0, sbuf_string(eb->input), eb->pos, &help);
+  if (hint == NULL) return false;
+  // replace a history hint 
+  sbuf_replace(eb->hint, hint);
+  editor_append_hint_help(eb, help);
+  eb->hint_history = false;
+  return true;
+}
+
+// read a key while displaying a hint after the hint delay and 
+// polling a background completer; a key press cancels the completer.
+static code_t edit_read_key(ic_env_t* env, editor_t* eb) {
+  code_t c;
+  long waited = 0;
+  bool shown = (env->hint_delay <= 0);
+  while (completions_pending(env->completions)) {
+    if (tty_read_timeout(env->tty, IC_ASYNC_POLL_MS, &c)) {
+      completions_cancel(env->completions);
+      if (!shown) {
+        // clear the pending hint if we got input before the delay expired
+        sbuf_clear(eb->hint);
+        sbuf_clear(eb->hint_help);
+      }
+      return c;
+    }
+    waited += IC_ASYNC_POLL_MS;
+    const bool changed = edit_async_hint(env, eb);
+    if (!shown && waited >= env->hint_delay) {
+      shown = true;
+      if (sbuf_len(eb->hint) > 0) { edit_refresh(env, eb); }
+    }
+    else if (shown && changed) {
+      edit_refresh(env, eb);
+    }
+    term_flush(env->term);
+  }
+  if (shown || sbuf_len(eb->hint) == 0) {
+    // blocking read
+    return tty_read(env->tty);
+  }
+  // timeout to display hint
+  if (!tty_read_timeout(env->tty, env->hint_delay - waited, &c)) {
+    // timed-out
+    if (sbuf_len(eb->hint) > 0) {
+      // display hint
+      edit_refresh(env, eb);
+    }
+    c = tty_read(env->tty);
+  }
+  else {
+    // clear the pending hint if we got input before the delay expired
+    sbuf_clear(eb->hint);
+    sbuf_clear(eb->hint_help);
+  }
+  return c;
+}
+
 //-------------------------------------------------------------
 // Edit operations
 //-------------------------------------------------------------
@@ -860,9 +933,13 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
   eb.modified = false;  
   eb.prompt_text   = (prompt_text != NULL ? prompt_text : "");
   eb.history_idx   = 0;  
+  eb.prompt   = sbuf_new(env->mem);
+  eb.attrs_prompt = attrbuf_new(env->mem);
+  eb.screen   = screen_new(env->mem, env->term);
   editstate_init(&eb.undo);
   editstate_init(&eb.redo);
-  if (eb.input==NULL || eb.extra==NULL || eb.hint==NULL || eb.hint_help==NULL) {
+  if (eb.input==NULL || eb.extra==NULL || eb.hint==NULL || eb.hint_help==NULL || 
+      eb.prompt==NULL || eb.attrs_prompt==NULL || eb.screen==NULL) {
     return NULL;
   }
 
@@ -873,7 +950,10 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
   }
   
   // show prompt
-  edit_write_prompt(env, &eb, 0, false);   
+  edit_refresh(env, &eb);
+
+  // merge entries added by other processes (if the history is shared)
+  history_sync(env->history);
 
   // always a history entry for the current input
   history_push(env->history, "");
@@ -883,26 +963,7 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
   while(true) {    
     // read a character
     term_flush(env->term);
-    if (env->hint_delay <= 0 || sbuf_len(eb.hint) == 0) {
-      // blocking read
-      c = tty_read(env->tty);
-    }
-    else {
-      // timeout to display hint
-      if (!tty_read_timeout(env->tty, env->hint_delay, &c)) {
-        // timed-out
-        if (sbuf_len(eb.hint) > 0) {
-          // display hint
-          edit_refresh(env, &eb);
-        }
-        c = tty_read(env->tty);
-      }
-      else {
-        // clear the pending hint if we got input before the delay expired
-        sbuf_clear(eb.hint);
-        sbuf_clear(eb.hint_help);
-      }
-    }
+    c = edit_read_key(env, &eb);
     
     // update terminal in case of a resize
     if (tty_term_resize_event(env->tty)) {
@@ -911,12 +972,26 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
 
     // clear hint only after a potential resize (so resize row calculations are correct)
     const bool had_hint = (sbuf_len(eb.hint) > 0);
+    if ((c == KEY_RIGHT || c == KEY_END) && had_hint && eb.hint_history) {
+      // accept a history hint as is
+      editor_start_modify(&eb);
+      eb.pos = sbuf_insert_at(eb.input, sbuf_string(eb.hint), eb.pos);
+    }
     sbuf_clear(eb.hint);
     sbuf_clear(eb.hint_help);
 
     // if the user tries to move into a hint with left-cursor or end, we complete it first
     if ((c == KEY_RIGHT || c == KEY_END) && had_hint) {
-      edit_generate_completions(env, &eb, true);
+      if (eb.hint_history) {
+        edit_refresh_hint(env, &eb);
+      }
+      else if (env->complete_async && completions_count(env->completions) == 1) {
+        // the hint came from a background completer; apply it without running the completer again
+        edit_complete(env, &eb, 0);
+      }
+      else {
+        edit_generate_completions(env, &eb, true);
+      }
       c = KEY_NONE;      
     }
 
@@ -970,6 +1045,9 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
       case KEY_CTRL_S:
         edit_history_search_with_current_word(env,&eb);
         break;
+      case WITH_ALT('r'):
+        edit_history_fuzzy_search_with_current_word(env,&eb);
+        break;
       case KEY_CTRL_P:
         edit_history_prev(env, &eb);
         break;
@@ -1125,6 +1203,7 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
   // update history
   history_update(env->history, sbuf_string(eb.input));
   if (res == NULL || sbuf_len(eb.input) <= 1) { ic_history_remove_last(); } // no empty or single-char entries
+  else { history_set_time(env->history, 0, (int64_t)time(NULL)); }
   history_save(env->history);
 
   // free resources 
@@ -1132,6 +1211,9 @@ static char* edit_line( ic_env_t* env, const char* prompt_text )
   editstate_done(env->mem, &eb.redo);
   attrbuf_free(eb.attrs);
   attrbuf_free(eb.attrs_extra);
+  attrbuf_free(eb.attrs_prompt);
+  sbuf_free(eb.prompt);
+  screen_free(eb.screen);
   sbuf_free(eb.input);
   sbuf_free(eb.extra);
   sbuf_free(eb.hint);
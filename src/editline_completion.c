@@ -87,14 +87,38 @@ static void editor_append_completion3(ic_env_t* env, editor_t* eb, ssize_t col_w
   editor_append_completion(env, eb, idx3, col_width, true, (idx3 == selected) );
 }
 
+// wait for asynchronous completions until there are at least `min` of them, or the completer is done
+// (or its deadline passed). Returns -1 if a key was pressed in the meantime (which is pushed back).
+static ssize_t edit_completions_wait(ic_env_t* env, ssize_t min, ssize_t max) {
+  completions_t* cms = env->completions;
+  completions_poll(cms);
+  while (completions_pending(cms) && completions_count(cms) < min) {
+    code_t c;
+    if (tty_read_timeout(env->tty, IC_ASYNC_POLL_MS, &c)) {
+      completions_clear(cms);
+      tty_code_pushback(env->tty, c);
+      return -1;
+    }
+    completions_poll(cms);
+  }
+  const ssize_t count = completions_count(cms);
+  return (count < max ? count : max);
+}
+
+// generate up to `max` completions; the completer runs in the background if asynchronous 
+// completion is enabled, and we wait for `min` completions (see `edit_completions_wait`).
+static ssize_t edit_completions_generate(ic_env_t* env, editor_t* eb, ssize_t min, ssize_t max) {
+  if (env->complete_async && 
+      completions_start(env, env->completions, sbuf_string(eb->input), eb->pos, max, env->complete_deadline)) {
+    return edit_completions_wait(env, min, max);
+  }
+  return completions_generate(env, env->completions, sbuf_string(eb->input), eb->pos, max);
+}
+
 static ssize_t edit_completions_max_width( ic_env_t* env, ssize_t count ) {
   ssize_t max_width = 0;
   for( ssize_t i = 0; i < count; i++) {
-    const char* help = NULL;
-    ssize_t w = bbcode_column_width(env->bbcode, completions_get_display(env->completions, i, &help));
-    if (help != NULL) {
-      w += 2 + bbcode_column_width(env->bbcode, help);
-    }
+    const ssize_t w = completions_get_width(env->completions, i, env->bbcode);
     if (w > max_width) {
       max_width = w;
     }
@@ -102,6 +126,116 @@ static ssize_t edit_completions_max_width( ic_env_t* env, ssize_t count ) {
   return max_width;
 }
 
+//-------------------------------------------------------------
+// Scrollable list of all completions: only the rows in view are
+// formatted, so moving through it takes the same time for 10 or 
+// 100k completions.
+//-------------------------------------------------------------
+
+#define IC_LIST_ROWS  (20)   // maximal rows of the list
+
+static void edit_completion_list(ic_env_t* env, editor_t* eb, ssize_t selected) {
+  completions_t* cms = env->completions;
+  ssize_t rows = term_get_height(env->term) - 4;  // leave room for the input and status
+  if (rows > IC_LIST_ROWS) rows = IC_LIST_ROWS;
+  if (rows < 3) rows = 3;
+  ssize_t top = 0;
+  ssize_t count;
+  if (selected < 0) selected = 0;
+
+again:
+  count = completions_count(cms);
+  if (count <= 0) {
+    edit_refresh(env,eb);
+    return;
+  }
+  if (selected >= count) selected = count - 1;
+  // keep the selection in view
+  if (selected < top) top = selected;
+  if (selected >= top + rows) top = selected - rows + 1;
+  // sort the rows in view, or all at once when all completions are there
+  completions_sort(cms, (completions_pending(cms) ? top + rows : count));
+
+  sbuf_clear(eb->extra);
+  ssize_t digits = 1;
+  for (ssize_t n = count; n >= 10; n /= 10) { digits++; }
+  const ssize_t width = term_get_width(env->term) - 2 - (digits + 2);  // stay below the wrap marker
+  const ssize_t end = (top + rows < count ? top + rows : count);
+  for (ssize_t i = top; i < end; i++) {
+    if (i > top) sbuf_append(eb->extra, "\n");
+    sbuf_appendf(eb->extra, "[ic-info]%s%*zd [/]", (i == selected ? (tty_is_utf8(env->tty) ? "\xE2\x86\x92" : "*") : " "), (int)digits, 1 + i);
+    editor_append_completion(env, eb, i, width, false, (i == selected));
+  }
+  const bool more = (completions_pending(cms) || count >= IC_MAX_COMPLETIONS_TO_LIST);
+  sbuf_appendf(eb->extra, "\n[ic-info](%zd-%zd of %s%zd completions)[/]", top + 1, end, (more ? "at least " : ""), count);
+  if (!env->complete_nopreview) {
+    edit_complete(env,eb,selected);
+    editor_undo_restore(eb,false);
+  }
+  else {
+    edit_refresh(env, eb);
+  }
+
+  // read a key while showing the completions that arrive in the background
+  code_t c;
+  while (completions_pending(cms)) {
+    if (tty_read_timeout(env->tty, IC_ASYNC_POLL_MS, &c)) break;
+    if (completions_poll(cms) || !completions_pending(cms)) goto again;
+  }
+  if (!completions_pending(cms)) {
+    c = tty_read(env->tty);
+  }
+  if (tty_term_resize_event(env->tty)) {
+    edit_resize(env, eb);
+  }
+  sbuf_clear(eb->extra);
+
+  // process commands
+  if (c == KEY_DOWN || c == KEY_TAB) {
+    selected = (selected + 1 < count ? selected + 1 : 0);
+    goto again;
+  }
+  else if (c == KEY_UP || c == KEY_SHIFT_TAB) {
+    selected = (selected > 0 ? selected - 1 : count - 1);
+    goto again;
+  }
+  else if (c == KEY_PAGEDOWN || c == KEY_LINEFEED) {
+    selected = (selected + rows < count ? selected + rows : count - 1);
+    goto again;
+  }
+  else if (c == KEY_PAGEUP) {
+    selected = (selected > rows ? selected - rows : 0);
+    goto again;
+  }
+  else if (c == KEY_F1) {
+    edit_show_help(env, eb);
+    goto again;
+  }
+  else if (c == KEY_ESC) {
+    completions_clear(cms);
+    edit_refresh(env,eb);
+    c = 0; // ignore and return
+  }
+  else if (c == KEY_ENTER || c == KEY_RIGHT || c == KEY_END) {
+    // select the current entry
+    c = 0;
+    edit_complete(env, eb, selected);
+    if (env->complete_autotab) {
+      tty_code_pushback(env->tty,KEY_EVENT_AUTOTAB); // immediately try to complete again
+    }
+  }
+  else if (!env->complete_nopreview && !code_is_virt_key(c)) {
+    // if in preview mode, select the current entry and exit the list
+    edit_complete(env, eb, selected);
+  }
+  else {
+    edit_refresh(env,eb);
+  }
+  // done
+  completions_clear(cms);
+  if (c != 0) tty_code_pushback(env->tty,c);
+}
+
 static void edit_completion_menu(ic_env_t* env, editor_t* eb, bool more_available) {
   ssize_t count = completions_count(env->completions);
   ssize_t count_displayed = count;
@@ -111,6 +245,7 @@ static void edit_completion_menu(ic_env_t* env, editor_t* eb, bool more_availabl
 
 again:
   // show first 9 (or 8) completions
+  completions_sort(env->completions, 9);
   sbuf_clear(eb->extra);
   ssize_t twidth = term_get_width(env->term) - 1;
   ssize_t colwidth;
@@ -158,7 +293,19 @@ again:
   }
 
   // read here; if not a valid key, push it back and return to main event loop
-  code_t c = tty_read(env->tty);
+  code_t c;
+  while (completions_pending(env->completions)) {
+    // keep showing the completions that arrive in the background
+    if (tty_read_timeout(env->tty, IC_ASYNC_POLL_MS, &c)) break;
+    if (completions_poll(env->completions) || !completions_pending(env->completions)) {
+      count = completions_count(env->completions);
+      more_available = (count >= IC_MAX_COMPLETIONS_TO_TRY);
+      goto again;
+    }
+  }
+  if (!completions_pending(env->completions)) {
+    c = tty_read(env->tty);
+  }
   if (tty_term_resize_event(env->tty)) {
     edit_resize(env, eb);
   }
@@ -213,35 +360,19 @@ again:
     assert(selected < count);
     edit_complete(env, eb, selected); 
   }
-  else if ((c == KEY_PAGEDOWN || c == KEY_LINEFEED) && count > 9) {
-    // show all completions
-    c = 0;
-    if (more_available) {
-      // generate all entries (up to the max (= 1000))
-      count = completions_generate(env, env->completions, sbuf_string(eb->input), eb->pos, IC_MAX_COMPLETIONS_TO_SHOW);
-    }
-    rowcol_t rc;
-    edit_get_rowcol(env,eb,&rc);
-    edit_clear(env,eb);
-    edit_write_prompt(env,eb,0,false);
-    term_writeln(env->term, "");
-    for(ssize_t i = 0; i < count; i++) {
-      const char* display = completions_get_display(env->completions, i, NULL);
-      if (display != NULL) {
-        bbcode_println(env->bbcode, display);
+  else if ((c == KEY_PAGEDOWN || c == KEY_LINEFEED) && count > count_displayed) {
+    // scroll through all completions
+    if (more_available || completions_pending(env->completions)) {
+      // generate all entries (up to the max (= 100k)), but start as soon as there is a page
+      count = edit_completions_generate(env, eb, IC_LIST_ROWS, IC_MAX_COMPLETIONS_TO_LIST);
+      if (count < 0) { 
+        // interrupted by a key press
+        edit_refresh(env,eb);
+        return;
       }
     }
-    if (count >= IC_MAX_COMPLETIONS_TO_SHOW) {
-      bbcode_println(env->bbcode, "[ic-info]... and more.[/]");
-    }
-    else {
-      bbcode_printf(env->bbcode, "[ic-info](%zd possible completions)[/]\n", count );
-    }
-    for(ssize_t i = 0; i < rc.row+1; i++) {
-      term_write(env->term, " \n");
-    }
-    eb->cur_rows = 0;
-    edit_refresh(env,eb);      
+    edit_completion_list(env, eb, selected);
+    return;
   }
   else {
     edit_refresh(env,eb);
@@ -254,7 +385,9 @@ again:
 static void edit_generate_completions(ic_env_t* env, editor_t* eb, bool autotab) {
   debug_msg( "edit: complete: %zd: %s\n", eb->pos, sbuf_string(eb->input) );
   if (eb->pos < 0) return;
-  ssize_t count = completions_generate(env, env->completions, sbuf_string(eb->input), eb->pos, IC_MAX_COMPLETIONS_TO_TRY);
+  // wait for at least two completions so we know whether to show the menu
+  ssize_t count = edit_completions_generate(env, eb, 2, IC_MAX_COMPLETIONS_TO_TRY);
+  if (count < 0) return;  // interrupted by a key press
   bool more_available = (count >= IC_MAX_COMPLETIONS_TO_TRY);
   if (count <= 0) {
     // no completions
@@ -268,10 +401,9 @@ static void edit_generate_completions(ic_env_t* env, editor_t* eb, bool autotab)
   }
   else {
     //term_beep(env->term); 
-    if (!more_available) { 
+    if (!more_available && !completions_pending(env->completions)) { 
       edit_complete_longest_prefix(env,eb);
     }    
-    completions_sort(env->completions);
     edit_completion_menu( env, eb, more_available);    
   }
 }
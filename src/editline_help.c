@@ -41,6 +41,7 @@ static const char* help[] = {
   "^p",         "go back in the history",
   "^n",         "go forward in the history",
   "^r,^s",      "search the history starting with the current word",
+  "alt-r",      "fuzzy search the history starting with the current word",
   "","",
 
   "", "Deletion:",
@@ -78,7 +79,8 @@ static const char* help[] = {
   "tab,down",   "select the next completion",
   "shift-tab,up","select the previous completion",
   "esc",        "exit menu without completing",
-  "pgdn,^j",    "show all further possible completions",
+  "pgdn,^j",    "scroll through all possible completions",
+  "pgup",       "scroll back in the list of all completions",
   "","",
   "","In incremental history search:",
   "enter",      "use the currently found history entry",
@@ -88,6 +90,14 @@ static const char* help[] = {
   "^r",         "find the next match",
   "shift-tab,"
   "^s",         "find an earlier match",
+  "alt-r",      "switch to fuzzy search",
+  "esc",        "exit search",
+  "","",
+  "","In fuzzy history search:",
+  "enter",      "use the selected history entry",
+  "tab,down",   "select the next best match",
+  "shift-tab,up","select the previous match",
+  "^r,^s",      "switch to incremental search",
   "esc",        "exit search",
   " ","",
   NULL, NULL
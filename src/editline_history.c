@@ -9,6 +9,24 @@
 // History search: this file is included in editline.c
 //-------------------------------------------------------------
 
+// find the entry from `eb->history_idx + ofs` on that starts with the typed input (the first entry),
+// skipping entries equal to the current input.
+static const char* edit_history_prefix_at(ic_env_t* env, editor_t* eb, int ofs ) 
+{
+  const char* prefix = history_get(env->history,0);
+  if (prefix == NULL) return NULL;
+  ssize_t hidx = eb->history_idx + ofs;
+  while (hidx >= 0 && history_prefix_search(env->history, hidx, prefix, ofs > 0, &hidx)) {
+    const char* entry = history_get(env->history,hidx);
+    if (hidx == 0 || strcmp(entry, sbuf_string(eb->input)) != 0) {
+      eb->history_idx = hidx;
+      return entry;
+    }
+    hidx += ofs;
+  }
+  return NULL;
+}
+
 static void edit_history_at(ic_env_t* env, editor_t* eb, int ofs ) 
 {
   if (eb->modified) { 
@@ -16,13 +34,19 @@ static void edit_history_at(ic_env_t* env, editor_t* eb, int ofs )
     eb->history_idx = 0;          // and start again 
     eb->modified = false;    
   }
-  const char* entry = history_get(env->history,eb->history_idx + ofs);
+  const char* entry = NULL;
+  if (env->history_prefix) {
+    entry = edit_history_prefix_at(env, eb, ofs);
+  }
+  else {
+    entry = history_get(env->history,eb->history_idx + ofs);
+    if (entry != NULL) { eb->history_idx += ofs; }
+  }
   // debug_msg( "edit: history: at: %d + %d, found: %s\n", eb->history_idx, ofs, entry);
   if (entry == NULL) {
     term_beep(env->term);
   }
   else {
-    eb->history_idx += ofs;
     sbuf_replace(eb->input, entry);
     if (ofs > 0) {
       // at end of first line when scrolling up
@@ -36,6 +60,16 @@ static void edit_history_at(ic_env_t* env, editor_t* eb, int ofs )
   }
 }
 
+// Use the rest of the most frequently and recently used history entry 
+// that starts with the input as a hint.
+static bool edit_history_hint(ic_env_t* env, editor_t* eb) {
+  if (!env->history_hint || eb->pos <= 0 || eb->pos != sbuf_len(eb->input)) return false;
+  ssize_t hidx;
+  if (!history_frecent_search(env->history, sbuf_string(eb->input), 0 /* the current input */, &hidx)) return false;
+  sbuf_replace(eb->hint, history_get(env->history,hidx) + eb->pos);
+  return true;
+}
+
 static void edit_history_prev(ic_env_t* env, editor_t* eb) {
   edit_history_at(env,eb, 1 );
 }
@@ -83,10 +117,11 @@ static void hsearch_done( alloc_t* mem, hsearch_t* hs ) {
   }
 }
 
-static void edit_history_search(ic_env_t* env, editor_t* eb, char* initial ) {
+// Incremental history search; returns the query to continue with in a fuzzy search (or NULL)
+static char* edit_history_search(ic_env_t* env, editor_t* eb, char* initial ) {
   if (history_count( env->history ) <= 0) {
     term_beep(env->term);
-    return;
+    return NULL;
   }
 
   // update history
@@ -109,6 +144,7 @@ static void edit_history_search(ic_env_t* env, editor_t* eb, char* initial ) {
   ssize_t match_pos = 0;       // current matched position
   ssize_t match_len = 0;       // length of the match
   const char* hentry = NULL;   // current history entry
+  char* fuzzy_query = NULL;    // switch to fuzzy search with this query
   
   // Simulate per character searches for each letter in `initial` (so backspace works)
   if (initial != NULL) {
@@ -206,6 +242,13 @@ again:
     edit_show_help(env, eb);
     goto again;
   }
+  else if (c == WITH_ALT('r')) {
+    // continue with a fuzzy search for the same input
+    c = 0;
+    fuzzy_query = mem_strdup(eb->mem, sbuf_string(eb->input));
+    eb->disable_undo = false;
+    editor_undo_restore(eb, false);
+  }
   else {
     // insert character and search further backward
     char chr;
@@ -240,11 +283,204 @@ again:
   ic_enable_hint(old_hint);
   edit_refresh(env,eb);
   if (c != 0) tty_code_pushback(env->tty, c);
+  return fuzzy_query;
 }
 
-// Start an incremental search with the current word 
-static void edit_history_search_with_current_word(ic_env_t* env, editor_t* eb) {
-  char* initial = NULL;
+
+//-------------------------------------------------------------
+// Fuzzy history search
+//-------------------------------------------------------------
+
+#define IC_HISTORY_FUZZY_SHOW  (8)
+
+static void edit_append_fuzzy_run(editor_t* eb, const char* s, ssize_t len, bool matched) {
+  if (len <= 0) return;
+  if (matched) sbuf_append(eb->extra, "[u ic-emphasis]");
+  sbuf_append(eb->extra, "[!pre]");
+  sbuf_append_n(eb->extra, s, len);
+  sbuf_append(eb->extra, "[/pre]");
+  if (matched) sbuf_append(eb->extra, "[/u]");
+}
+
+static void edit_append_fuzzy_match(ic_env_t* env, editor_t* eb, const char* entry, const char* query, ssize_t* positions, bool selected ) {
+  sbuf_appendf(eb->extra, "[ic-info]%s [/]", (selected ? (tty_is_utf8(env->tty) ? "\xE2\x86\x92" : "*") : " "));
+  if (selected) sbuf_append(eb->extra, "[ic-emphasis]");
+  // only show the first line of an entry
+  const char* eol = strchr(entry, '\n');
+  const ssize_t len = (eol == NULL ? ic_strlen(entry) : eol - entry);
+  ssize_t query_len = ic_strlen(query);
+  if (fuzzy_score(query, query_len, entry, ic_strlen(entry), positions) < 0) query_len = 0;
+  // emphasize the matched characters
+  ssize_t pi = 0;
+  ssize_t run = 0;             // start of the current run of (un)matched characters
+  bool run_matched = false;
+  for( ssize_t pos = 0; pos < len; ) {
+    ssize_t next = str_next_ofs(entry, len, pos, NULL);
+    if (next <= 0) next = 1;
+    bool matched = false;
+    while (pi < query_len && positions[pi] < pos + next) { pi++; matched = true; }
+    if (pos > run && matched != run_matched) {
+      edit_append_fuzzy_run(eb, entry + run, pos - run, run_matched);
+      run = pos;
+    }
+    run_matched = matched;
+    pos += next;
+  }
+  edit_append_fuzzy_run(eb, entry + run, len - run, run_matched);
+  if (eol != NULL) sbuf_append(eb->extra, " ...");
+  if (selected) sbuf_append(eb->extra, "[/ic-emphasis]");
+  sbuf_append(eb->extra, "\n");
+}
+
+// Fuzzy history search; returns the query to continue with in a substring search (or NULL)
+static char* edit_history_fuzzy_search(ic_env_t* env, editor_t* eb, const char* initial ) {
+  if (history_count( env->history ) <= 0) {
+    term_beep(env->term);
+    return NULL;
+  }
+
+  // update history
+  if (eb->modified) { 
+    history_update(env->history, sbuf_string(eb->input)); // update first entry if modified
+    eb->history_idx = 0;               // and start again 
+    eb->modified = false;
+  }
+
+  // set a search prompt and remember the previous state
+  editor_undo_capture(eb);
+  eb->disable_undo = true;
+  bool old_hint = ic_enable_hint(false);  
+  const char* prompt_text = eb->prompt_text;
+  eb->prompt_text = "fuzzy search";
+  sbuf_replace(eb->input, (initial == NULL ? "" : initial));
+  eb->pos = sbuf_len(eb->input);
+
+  // search state
+  ssize_t matches[IC_HISTORY_FUZZY_SHOW];  // best matches first
+  ssize_t count = 0;
+  ssize_t selected = 0;
+  ssize_t* positions = NULL;   // matched positions of the query
+  bool query_changed = true;
+  char* substring_query = NULL;  // switch to a substring search with this query
+
+again:
+  if (query_changed) {
+    count = history_fuzzy_search(env->history, sbuf_string(eb->input), matches, IC_HISTORY_FUZZY_SHOW);
+    selected = 0;
+    query_changed = false;
+    mem_free(eb->mem, positions);
+    positions = mem_malloc_tp_n(eb->mem, ssize_t, sbuf_len(eb->input) + 1);
+  }
+  for (ssize_t i = 0; i < count && positions != NULL; i++) {
+    const char* entry = history_get(env->history, matches[i]);
+    if (entry == NULL) continue;
+    edit_append_fuzzy_match(env, eb, entry, sbuf_string(eb->input), positions, i == selected);
+  }
+  if (count == 0) {
+    sbuf_append(eb->extra, "[ic-info](no matches)[/]\n");
+  }
+  else if (!env->no_help) {
+    sbuf_append(eb->extra, "[ic-info](use up/down to select a match)[/]\n");
+  }
+  edit_refresh(env, eb);
+
+  // Wait for input
+  code_t c = tty_read(env->tty);
+  if (tty_term_resize_event(env->tty)) {
+    edit_resize(env, eb);
+  }
+  sbuf_clear(eb->extra);
+
+  // Process commands
+  if (c == KEY_ESC || c == KEY_BELL /* ^G */ || c == KEY_CTRL_C) {
+    c = 0;  
+    eb->disable_undo = false;
+    editor_undo_restore(eb, false);
+  } 
+  else if (c == KEY_ENTER) {
+    c = 0;
+    eb->disable_undo = false;
+    if (count > 0) {
+      editor_undo_forget(eb);
+      sbuf_replace( eb->input, history_get(env->history, matches[selected]) );
+      eb->pos = sbuf_len(eb->input);
+      eb->modified = false;
+      eb->history_idx = matches[selected];
+    }
+    else {
+      editor_undo_restore(eb, false);
+    }
+  }  
+  else if (c == KEY_UP || c == KEY_SHIFT_TAB || c == KEY_CTRL_P) {
+    if (selected > 0) selected--; else term_beep(env->term);
+    goto again;
+  }
+  else if (c == KEY_DOWN || c == KEY_TAB || c == KEY_CTRL_N) {
+    if (selected + 1 < count) selected++; else term_beep(env->term);
+    goto again;
+  }
+  else if (c == KEY_BACKSP) {
+    if (eb->pos > 0) { 
+      edit_backspace(env, eb); 
+      query_changed = true;
+    }
+    else {
+      term_beep(env->term);
+    }
+    goto again;
+  }
+  else if (c == KEY_CTRL_R || c == KEY_CTRL_S) {
+    // continue with a substring search for the same input
+    c = 0;
+    substring_query = mem_strdup(eb->mem, sbuf_string(eb->input));
+    eb->disable_undo = false;
+    editor_undo_restore(eb, false);
+  }
+  else if (c == KEY_F1) {
+    edit_show_help(env, eb);
+    goto again;
+  }
+  else {
+    // insert character and search again
+    char chr;
+    unicode_t uchr;
+    if (code_is_ascii_char(c,&chr)) {
+      edit_insert_char(env,eb,chr);      
+    }
+    else if (code_is_unicode(c,&uchr)) {
+      edit_insert_unicode(env,eb,uchr);
+    }
+    else {
+      // ignore command
+      term_beep(env->term);
+      goto again;
+    }
+    query_changed = true;
+    goto again;
+  }
+
+  // done
+  mem_free(eb->mem, positions);
+  eb->prompt_text = prompt_text;
+  ic_enable_hint(old_hint);
+  edit_refresh(env,eb);
+  return substring_query;
+}
+
+// Run a history search and switch between the substring and fuzzy search
+// for as long as the user toggles between them (with ^r and alt-r)
+static void edit_history_search_modes(ic_env_t* env, editor_t* eb, char* initial, bool fuzzy) {
+  char* query = (fuzzy ? edit_history_fuzzy_search(env, eb, initial) : edit_history_search(env, eb, initial));
+  while (query != NULL) {
+    fuzzy = !fuzzy;
+    char* next = (fuzzy ? edit_history_fuzzy_search(env, eb, query) : edit_history_search(env, eb, query));
+    mem_free(env->mem, query);
+    query = next;
+  }
+}
+
+// The current word before the cursor (or NULL)
+static char* edit_history_current_word(editor_t* eb) {
   ssize_t start = sbuf_find_word_start( eb->input, eb->pos );
   if (start >= 0) {
     const ssize_t next = sbuf_next(eb->input, start, NULL);
@@ -252,9 +488,22 @@ static void edit_history_search_with_current_word(ic_env_t* env, editor_t* eb) {
       start = next; 
     }
     if (start >= 0 && start < eb->pos) {
-      initial = mem_strndup(eb->mem, sbuf_string(eb->input) + start, eb->pos - start);
+      return mem_strndup(eb->mem, sbuf_string(eb->input) + start, eb->pos - start);
     }
   }
-  edit_history_search( env, eb, initial);
+  return NULL;
+}
+
+// Start an incremental search with the current word 
+static void edit_history_search_with_current_word(ic_env_t* env, editor_t* eb) {
+  char* initial = edit_history_current_word(eb);
+  edit_history_search_modes( env, eb, initial, false);
+  mem_free(env->mem, initial);
+}
+
+// Start a fuzzy search with the current word
+static void edit_history_fuzzy_search_with_current_word(ic_env_t* env, editor_t* eb) {
+  char* initial = edit_history_current_word(eb);
+  edit_history_search_modes( env, eb, initial, true);
   mem_free(env->mem, initial);
 }
@@ -28,6 +28,7 @@ struct ic_env_s {
   tty_t*          tty;              // keyboard (NULL if stdin is a pipe, file, etc)
   completions_t*  completions;      // current completions
   history_t*      history;          // edit history
+  dircache_t*     dircache;         // cached directory listings for file completion (can be NULL)
   bbcode_t*       bbcode;           // print with bbcodes
   const char*     prompt_marker;    // the prompt marker (defaults to "> ")
   const char*     cprompt_marker;   // prompt marker for continuation lines (defaults to `prompt_marker`)
@@ -42,13 +43,19 @@ struct ic_env_s {
   bool            complete_nopreview; // do not show completion preview for each selection in the completion menu?
   bool            complete_autotab; // try to keep completing after a completion?
   bool            no_multiline_indent; // indent continuation lines to line up under the initial prompt 
+  bool            no_incremental_refresh; // redraw all rows on each refresh (instead of only the changed cells)?
   bool            no_help;          // show short help line for history search etc.
   bool            no_hint;          // allow hinting?
   bool            no_highlight;     // enable highlighting?
   bool            no_bracematch;    // enable brace matching?
   bool            no_autobrace;     // enable automatic brace insertion?
   bool            no_lscolors;      // use LSCOLORS/LS_COLORS to colorize file name completions?
+  bool            history_prefix;   // only visit entries starting with the input when navigating the history?
+  bool            history_hint;     // hint with the latest history entry starting with the input?
   long            hint_delay;       // delay before displaying a hint in milliseconds
+  bool            complete_async;   // run the completer on a background thread?
+  long            complete_deadline; // show partial completions after this many milliseconds
+  bool            complete_parallel; // list the roots of file name completion in parallel?
 };
 
 ic_private char*        ic_editline(ic_env_t* env, const char* prompt_text);
@@ -0,0 +1,226 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "common.h"
+#include "fuzzy.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IC_FUZZY_SSE2  1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//-------------------------------------------------------------
+// Character bitmaps
+//-------------------------------------------------------------
+
+static uint64_t fuzzy_charbit( uint8_t c ) {
+  if (c >= 'A' && c <= 'Z') c = (uint8_t)(c - 'A' + 'a');
+  if (c >= 'a' && c <= 'z') return (1ULL << (c - 'a'));
+  if (c >= '0' && c <= '9') return (1ULL << (26 + (c - '0')));
+  return (1ULL << (36 + (c % 28)));
+}
+
+ic_private uint64_t fuzzy_charmask( const char* s, ssize_t len ) {
+  uint64_t mask = 0;
+  for( ssize_t i = 0; i < len; i++) {
+    mask |= fuzzy_charbit((uint8_t)s[i]);
+  }
+  return mask;
+}
+
+
+//-------------------------------------------------------------
+// Scoring (similar to the fzf "v1" algorithm): find the first
+// match of the pattern, shrink it from the back to the shortest
+// match ending there, and score it with bonuses for matches at
+// word boundaries and consecutive matches, and penalties for gaps.
+//-------------------------------------------------------------
+
+#define FUZZY_SCORE_MATCH         (16)
+#define FUZZY_GAP_START           (-3)
+#define FUZZY_GAP_EXTEND          (-1)
+#define FUZZY_BONUS_WHITE         (10)   // after white space
+#define FUZZY_BONUS_DELIMITER     (9)    // after a path or option delimiter
+#define FUZZY_BONUS_BOUNDARY      (8)    // after any other non-word character
+#define FUZZY_BONUS_CAMEL         (7)    // lower to upper case, or letter to digit
+#define FUZZY_BONUS_CONSECUTIVE   (4)
+#define FUZZY_BONUS_FIRST_FACTOR  (2)
+
+typedef enum fuzzy_class_e {
+  FC_WHITE,
+  FC_DELIMITER,
+  FC_OTHER,
+  FC_LOWER,
+  FC_UPPER,
+  FC_DIGIT
+} fuzzy_class_t;
+
+static fuzzy_class_t fuzzy_class( char c ) {
+  if (c >= 'a' && c <= 'z') return FC_LOWER;
+  if (c >= 'A' && c <= 'Z') return FC_UPPER;
+  if (c >= '0' && c <= '9') return FC_DIGIT;
+  if ((uint8_t)c >= 0x80) return FC_LOWER;   // part of a unicode character
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return FC_WHITE;
+  if (c == '/' || c == '\\' || c == ',' || c == ':' || c == ';' || c == '|' || c == '-' || c == '_' || c == '.' || c == '=') return FC_DELIMITER;
+  return FC_OTHER;
+}
+
+static int fuzzy_bonus( fuzzy_class_t prev, fuzzy_class_t cur ) {
+  if (cur == FC_WHITE || cur == FC_DELIMITER || cur == FC_OTHER) return 0;
+  if (prev == FC_WHITE) return FUZZY_BONUS_WHITE;
+  if (prev == FC_DELIMITER) return FUZZY_BONUS_DELIMITER;
+  if (prev == FC_OTHER) return FUZZY_BONUS_BOUNDARY;
+  if ((prev == FC_LOWER && cur == FC_UPPER) || (prev != FC_DIGIT && cur == FC_DIGIT)) return FUZZY_BONUS_CAMEL;
+  return 0;
+}
+
+static bool fuzzy_eq( char c, char p, bool ignore_case ) {
+  return (c == p || (ignore_case && ic_tolower(c) == p));
+}
+
+#if defined(IC_FUZZY_SSE2)
+static ssize_t fuzzy_ctz( unsigned int bits ) {
+  #if defined(_MSC_VER)
+  unsigned long idx;
+  _BitScanForward(&idx, bits);
+  return (ssize_t)idx;
+  #else
+  return (ssize_t)__builtin_ctz(bits);
+  #endif
+}
+#endif
+
+// Find the first `c` or `cu` in `s[from,len)`, 16 bytes at a time if possible. Returns `len` if not found.
+static ssize_t fuzzy_find( const char* s, ssize_t from, ssize_t len, char c, char cu ) {
+  ssize_t i = from;
+  #if defined(IC_FUZZY_SSE2)
+  const __m128i vc = _mm_set1_epi8(c);
+  const __m128i vcu = _mm_set1_epi8(cu);
+  for( ; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+    const int bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vcu)));
+    if (bits != 0) return (i + fuzzy_ctz((unsigned int)bits));
+  }
+  #endif
+  for( ; i < len; i++) {
+    if (s[i] == c || s[i] == cu) return i;
+  }
+  return len;
+}
+
+ic_private int fuzzy_score( const char* pattern, ssize_t pattern_len, const char* s, ssize_t len, ssize_t* positions ) {
+  if (pattern_len <= 0) return 0;
+  if (pattern_len > len) return -1;
+  // smart case: ignore case if the pattern is all lower case (and compare with lower case pattern characters)
+  bool ignore_case = true;
+  for( ssize_t i = 0; i < pattern_len; i++) {
+    if (pattern[i] >= 'A' && pattern[i] <= 'Z') { ignore_case = false; break; }
+  }
+  // find the end of the first match
+  ssize_t end = 0;
+  for( ssize_t pi = 0; pi < pattern_len; pi++) {
+    const char p = pattern[pi];
+    end = fuzzy_find(s, end, len, p, (ignore_case && p >= 'a' && p <= 'z' ? (char)(p - 'a' + 'A') : p));
+    if (end >= len) return -1;
+    end++;
+  }
+  // and go back to find the shortest match ending there
+  ssize_t start = 0;
+  ssize_t pi = pattern_len - 1;
+  for( ssize_t i = end - 1; i >= 0; i--) {
+    if (fuzzy_eq(s[i], pattern[pi], ignore_case)) {
+      if (pi == 0) { start = i; break; }
+      pi--;
+    }
+  }
+  // score the match
+  int score = 0;
+  int first_bonus = 0;       // bonus of the first character of a consecutive run
+  ssize_t consecutive = 0;
+  bool in_gap = false;
+  fuzzy_class_t prev = (start > 0 ? fuzzy_class(s[start-1]) : FC_WHITE);
+  pi = 0;
+  for( ssize_t i = start; i < end; i++) {
+    const fuzzy_class_t cls = fuzzy_class(s[i]);
+    if (pi < pattern_len && fuzzy_eq(s[i], pattern[pi], ignore_case)) {
+      int bonus = fuzzy_bonus(prev, cls);
+      if (consecutive == 0) {
+        first_bonus = bonus;
+      }
+      else {
+        // a consecutive run keeps the bonus of its start
+        if (bonus < first_bonus) bonus = first_bonus;
+        if (bonus < FUZZY_BONUS_CONSECUTIVE) bonus = FUZZY_BONUS_CONSECUTIVE;
+      }
+      score += FUZZY_SCORE_MATCH + (pi == 0 ? FUZZY_BONUS_FIRST_FACTOR*bonus : bonus);
+      if (positions != NULL) positions[pi] = i;
+      pi++;
+      consecutive++;
+      in_gap = false;
+    }
+    else {
+      score += (in_gap ? FUZZY_GAP_EXTEND : FUZZY_GAP_START);
+      in_gap = true;
+      consecutive = 0;
+    }
+    prev = cls;
+  }
+  return (score < 0 ? 0 : score);
+}
+
+
+//-------------------------------------------------------------
+// Keep the best matches in a min-heap
+//-------------------------------------------------------------
+
+// is `a` a worse match than `b`?
+static bool fuzzy_worse( const fuzzy_match_t* a, const fuzzy_match_t* b ) {
+  return (a->score < b->score || (a->score == b->score && a->tie < b->tie));
+}
+
+static void fuzzy_sift_down( fuzzy_match_t* heap, ssize_t count, ssize_t i ) {
+  while (true) {
+    ssize_t least = i;
+    const ssize_t l = 2*i + 1;
+    const ssize_t r = l + 1;
+    if (l < count && fuzzy_worse(&heap[l], &heap[least])) least = l;
+    if (r < count && fuzzy_worse(&heap[r], &heap[least])) least = r;
+    if (least == i) return;
+    fuzzy_match_t tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
+  }
+}
+
+ic_private void fuzzy_top_push( fuzzy_match_t* heap, ssize_t* count, ssize_t max, int score, ssize_t tie ) {
+  fuzzy_match_t m = { score, tie };
+  if (*count < max) {
+    // sift up
+    ssize_t i = (*count)++;
+    while (i > 0 && fuzzy_worse(&m, &heap[(i-1)/2])) {
+      heap[i] = heap[(i-1)/2];
+      i = (i-1)/2;
+    }
+    heap[i] = m;
+  }
+  else if (max > 0 && fuzzy_worse(&heap[0], &m)) {
+    heap[0] = m;
+    fuzzy_sift_down(heap, *count, 0);
+  }
+}
+
+ic_private ssize_t fuzzy_top_pop( fuzzy_match_t* heap, ssize_t* count ) {
+  const ssize_t tie = heap[0].tie;
+  heap[0] = heap[--(*count)];
+  fuzzy_sift_down(heap, *count, 0);
+  return tie;
+}
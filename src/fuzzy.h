@@ -0,0 +1,38 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef IC_FUZZY_H
+#define IC_FUZZY_H
+
+#include "common.h"
+
+//-------------------------------------------------------------
+// Fuzzy matching
+//-------------------------------------------------------------
+
+// Bitmap of the (case folded) characters in a string. A string can only match
+// a pattern if its bitmap contains all bits of the bitmap of the pattern.
+ic_private uint64_t fuzzy_charmask( const char* s, ssize_t len );
+
+// Score a match of `pattern` as a subsequence of `s`; higher is better and -1 if there is no match.
+// Matching ignores case unless the pattern contains an upper case letter.
+// If `positions` is not NULL, it receives the offsets of the `pattern_len` matched bytes.
+ic_private int fuzzy_score( const char* pattern, ssize_t pattern_len, const char* s, ssize_t len, ssize_t* positions );
+
+// A match in a bounded min-heap of the best matches.
+typedef struct fuzzy_match_s {
+  int     score;
+  ssize_t tie;    // on equal scores the match with the higher `tie` is better
+} fuzzy_match_t;
+
+// Push a match on a heap of at most `max` best matches (dropping the worst one if full).
+ic_private void fuzzy_top_push( fuzzy_match_t* heap, ssize_t* count, ssize_t max, int score, ssize_t tie );
+
+// Pop the worst match from the heap (`*count > 0`) and return its `tie`.
+ic_private ssize_t fuzzy_top_pop( fuzzy_match_t* heap, ssize_t* count );
+
+#endif // IC_FUZZY_H
@@ -7,25 +7,149 @@
 #include <stdio.h>
 #include <string.h>  
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <float.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
 
 #include "../include/isocline.h"
 #include "common.h"
 #include "history.h"
 #include "stringbuf.h"
+#include "fuzzy.h"
 
-#define IC_MAX_HISTORY (200)
+#define IC_DEFAULT_HISTORY  (200)
+#define IC_HISTORY_CHUNK    (1024)    // slots per chunk
+#define IC_HISTORY_JOURNAL_SLACK (64)  // extra entries in a journal before it is compacted
+#define IC_HISTORY_SORTED_PENDING (256)  // entries pushed before they are merged in the sorted index
+#define IC_HISTORY_MARK          (32)  // bytes before the file offset that must be unchanged to read on
+#define IC_HISTORY_HALF_LIFE     (7*24*3600)  // seconds after which a use counts half in the frecency
+
+// Entries are addressed by a monotonically increasing sequence number and
+// stored in fixed size chunks that are allocated on demand, so memory stays
+// proportional to the number of entries. Removing an older duplicate leaves 
+// an empty slot behind such that pushing never shifts entries. Entry strings 
+// are allocated in an arena. Empty slots and arena space of removed entries
+// are reclaimed by compacting once they take up more than half of the space.
+// A hash index maps entries to their sequence number for duplicate detection.
+// A trigram index is built on the first search and speeds up substring
+// searches by only considering entries that contain all trigrams of the query.
+// Fuzzy searches use a per entry character mask as a prefilter.
+// Prefix searches use a sorted index that is built on demand; recently
+// pushed entries are scanned until enough of them accumulated to be merged.
+// Entry metadata (time, duration, status, working directory) is stored in
+// fixed-width columns per chunk that are only allocated once used. 
+// Hints use the entry with the highest frecency (frequency times an exponential
+// decay of the age) that extends the input. As the decay is the same for all
+// entries their order does not change over time, and a segment tree over the
+// sorted index finds the best entry for a prefix range in logarithmic time.
+
+typedef struct hbucket_s {
+  uint32_t hash;
+  ssize_t  seq;                // -1 if the bucket is empty
+} hbucket_t;
+
+// Postings of the trigram index used for searching.
+typedef struct tpostings_s {
+  uint32_t  tgram;             // the trigram (0 if the bucket is empty)
+  uint32_t  len;
+  uint32_t  cap;
+  uint32_t* seqs;              // ascending sequence numbers of entries that contain the trigram
+} tpostings_t;
+
+// Entry of the sorted prefix index. It is only valid if the slot of `seq` still
+// holds `entry` (the entry string stays allocated until the history is compacted).
+typedef struct hsorted_s {
+  const char* entry;
+  ssize_t     seq;
+} hsorted_t;
+
+// Metadata of an entry.
+typedef struct hmeta_s {
+  int64_t  time;               // seconds since the epoch (0 if unknown)
+  uint32_t duration;           // in milliseconds
+  int32_t  status;             // status code provided by the host (like an exit code)
+  uint32_t cwd;                // working directory id (0 if unknown)
+  uint32_t uses;               // number of times the entry was entered (0 if unknown, counts as once)
+} hmeta_t;
+
+// Metadata columns of a chunk.
+typedef struct hmetacols_s {
+  int64_t  time[IC_HISTORY_CHUNK];
+  uint32_t duration[IC_HISTORY_CHUNK];
+  int32_t  status[IC_HISTORY_CHUNK];
+  uint32_t cwd[IC_HISTORY_CHUNK];
+  uint32_t uses[IC_HISTORY_CHUNK];
+} hmetacols_t;
+
+typedef struct hchunk_s {
+  ssize_t     live;                     // number of slots in use
+  ssize_t     masked;                   // number of leading slots with a valid character mask
+  hmetacols_t* meta;                    // metadata (NULL if no entry in this chunk has metadata)
+  const char* elems[IC_HISTORY_CHUNK];  // history items (NULL if not in use)
+  uint64_t    masks[IC_HISTORY_CHUNK];  // character masks for fuzzy search (computed on demand)
+} hchunk_t;
 
 struct history_s {
   ssize_t  count;              // current number of entries in use
-  ssize_t  len;                // size of elems 
-  const char** elems;         // history items (up to count)
-  const char*  fname;         // history file
+  ssize_t  len;                // maximum number of entries
+  ssize_t  first;              // sequence number of the oldest slot in use
+  ssize_t  next;               // sequence number of the next pushed entry
+  hchunk_t** chunks;           // chunks[i] holds the slots of chunk number `chunk_first + i`
+  ssize_t  chunk_first;        // chunk number of the first chunk
+  ssize_t  chunk_count;        // number of chunks
+  ssize_t  chunk_len;          // size of the chunks array
+  arena_t* strings;            // allocated entry strings
+  ssize_t  strings_live;       // bytes used by the entries in use
+  hbucket_t* index;            // hash index from entries to sequence numbers
+  ssize_t  index_len;          // size of the index (a power of 2)
+  tpostings_t* tindex;         // trigram index (NULL if not built yet)
+  ssize_t  tindex_len;         // size of the trigram index (a power of 2)
+  ssize_t  tindex_count;       // number of trigrams in the index
+  hsorted_t* sorted;           // entries sorted by their text (NULL if not built yet)
+  ssize_t  sorted_count;
+  ssize_t  sorted_next;        // entries from this sequence number on are not yet in `sorted`
+  double*  rank;               // frecency of the sorted entries (NULL if not built yet)
+  uint32_t* rank_tree;         // segment tree of the sorted position with the highest frecency
+  uint32_t* found;             // ascending sequence numbers of all entries containing `found_query`
+  ssize_t  found_count;        // (or starting with it if `found_prefix` is set)
+  ssize_t  found_len;
+  const char* found_query;     // query of the last indexed search (NULL if not valid)
+  bool     found_prefix;
+  char**   cwds;               // interned working directories (`cwds[i]` has id `i+1`)
+  ssize_t  cwds_count;
+  ssize_t  cwds_len;
+  uint32_t* cwds_index;        // hash index of working directory ids (linear probing, 0 if empty)
+  ssize_t  cwds_index_len;
+  const char*  fname;          // history file
+  ssize_t  saved_next;         // entries from this sequence number on are not yet saved
+  ssize_t  file_entries;       // number of entries in the history file
+  ssize_t  file_offset;        // size of the history file that we have read or written
+  time_t   file_mtime;         // last modification time of the history file (as we left it)
+  uint64_t file_ino;           // identity of the history file (to detect it was replaced)
+  uint64_t file_dev;
+  char     file_mark[IC_HISTORY_MARK];  // the last bytes before `file_offset` (to detect a rewrite)
+  ssize_t  file_mark_len;
+  bool     file_stale;         // the file contains entries that were removed since
+  bool     file_displaced;     // an unsaved entry replaced a saved duplicate
+  bool     file_tail_ours;     // the file ends with our last saved entry
+  bool     meta_pending;       // the last saved entry got metadata after it was saved
   alloc_t* mem;
   bool     allow_duplicates;   // allow duplicate entries?
+  bool     journal;            // append new entries to the file instead of rewriting it?
+  bool     journal_sync;       // and sync the file after each append?
+  bool     shared;             // share the history file with other processes?
 };
 
 ic_private history_t* history_new(alloc_t* mem) {
   history_t* h = mem_zalloc_tp(mem,history_t);
+  if (h == NULL) return NULL;
   h->mem = mem;
   return h;
 }
@@ -33,25 +157,698 @@ ic_private history_t* history_new(alloc_t* mem) {
 ic_private void history_free(history_t* h) {
   if (h == NULL) return;
   history_clear(h);
-  if (h->len > 0) {
-    mem_free( h->mem, h->elems );
-    h->elems = NULL;
-    h->len = 0;
+  mem_free(h->mem, h->chunks);
+  mem_free(h->mem, h->index);
+  mem_free(h->mem, h->found);
+  for( ssize_t i = 0; i < h->cwds_count; i++) {
+    mem_free(h->mem, h->cwds[i]);
   }
+  mem_free(h->mem, h->cwds);
+  mem_free(h->mem, h->cwds_index);
+  arena_free(h->strings);
+  h->chunks = NULL;
+  h->index = NULL;
+  h->strings = NULL;
+  h->len = 0;
   mem_free(h->mem, h->fname);
   h->fname = NULL;
   mem_free(h->mem, h); // free ourselves
 }
 
+ic_private ssize_t  history_count(const history_t* h) {
+  return h->count;
+}
+
+static hchunk_t* history_chunk( const history_t* h, ssize_t seq ) {
+  assert(seq >= h->chunk_first*IC_HISTORY_CHUNK && seq/IC_HISTORY_CHUNK - h->chunk_first < h->chunk_count);
+  return h->chunks[seq/IC_HISTORY_CHUNK - h->chunk_first];
+}
+
+static const char** history_slot( const history_t* h, ssize_t seq ) {
+  assert(seq >= h->first && seq < h->next);
+  return &history_chunk(h,seq)->elems[seq % IC_HISTORY_CHUNK];
+}
+
+// ensure there is a chunk for the next sequence number
+static bool history_ensure_chunk( history_t* h ) {
+  if (h->chunk_count == 0) {
+    h->chunk_first = h->next / IC_HISTORY_CHUNK;
+  }
+  if (h->next/IC_HISTORY_CHUNK - h->chunk_first < h->chunk_count) return true;
+  if (h->chunk_count >= h->chunk_len) {
+    ssize_t newlen = (h->chunk_len <= 0 ? 4 : 2*h->chunk_len);
+    hchunk_t** newchunks = mem_realloc_tp(h->mem, hchunk_t*, h->chunks, newlen);
+    if (newchunks == NULL) return false;
+    h->chunks = newchunks;
+    h->chunk_len = newlen;
+  }
+  hchunk_t* c = mem_zalloc_tp(h->mem, hchunk_t);
+  if (c == NULL) return false;
+  h->chunks[h->chunk_count++] = c;
+  return true;
+}
+
+// free chunks that are entirely before the first slot in use
+static void history_chunk_free( history_t* h, hchunk_t* c ) {
+  mem_free(h->mem, c->meta);
+  mem_free(h->mem, c);
+}
+
+static void history_free_old_chunks( history_t* h ) {
+  ssize_t n = 0;
+  while (n < h->chunk_count && (h->chunk_first + n + 1)*IC_HISTORY_CHUNK <= h->first) {
+    assert(h->chunks[n]->live == 0);
+    history_chunk_free(h, h->chunks[n]);
+    n++;
+  }
+  if (n > 0) {
+    ic_memmove(h->chunks, h->chunks + n, (h->chunk_count - n)*ssizeof(hchunk_t*));
+    h->chunk_first += n;
+    h->chunk_count -= n;
+  }
+}
+
+
+//-------------------------------------------------------------
+// Metadata
+//-------------------------------------------------------------
+
+static bool hmeta_is_empty( const hmeta_t* m ) {
+  return (m->time == 0 && m->duration == 0 && m->status == 0 && m->cwd == 0 && m->uses <= 1);
+}
+
+static void history_meta_get( const history_t* h, ssize_t seq, hmeta_t* m ) {
+  const hmetacols_t* cols = history_chunk(h,seq)->meta;
+  const ssize_t i = seq % IC_HISTORY_CHUNK;
+  if (cols == NULL) {
+    memset(m, 0, sizeof(*m));
+  }
+  else {
+    m->time = cols->time[i];
+    m->duration = cols->duration[i];
+    m->status = cols->status[i];
+    m->cwd = cols->cwd[i];
+    m->uses = cols->uses[i];
+  }
+}
+
+static void hrank_update( history_t* h, ssize_t seq );
+
+static bool history_meta_put( history_t* h, ssize_t seq, const hmeta_t* m ) {
+  hchunk_t* c = history_chunk(h,seq);
+  if (c->meta == NULL) {
+    if (hmeta_is_empty(m)) return true;
+    c->meta = mem_zalloc_tp(h->mem, hmetacols_t);
+    if (c->meta == NULL) return false;
+  }
+  const ssize_t i = seq % IC_HISTORY_CHUNK;
+  c->meta->time[i] = m->time;
+  c->meta->duration[i] = m->duration;
+  c->meta->status[i] = m->status;
+  c->meta->cwd[i] = m->cwd;
+  c->meta->uses[i] = m->uses;
+  hrank_update(h, seq);
+  return true;
+}
+
+static uint32_t history_cwd_hash( const history_t* h, uint32_t hash ) {
+  return (uint32_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ULL) >> 40) & (uint32_t)(h->cwds_index_len - 1);
+}
+
+// get the id of a working directory (adding it if needed); returns 0 on failure
+static uint32_t history_cwd_intern( history_t* h, const char* cwd, ssize_t len ) {
+  if (cwd == NULL || len <= 0) return 0;
+  const uint32_t hash = ic_strnhash(cwd, len);
+  if (h->cwds_index != NULL) {
+    for( uint32_t i = history_cwd_hash(h,hash); h->cwds_index[i] != 0; i = (i+1) & (uint32_t)(h->cwds_index_len - 1)) {
+      const char* dir = h->cwds[h->cwds_index[i]-1];
+      if (strncmp(dir, cwd, to_size_t(len)) == 0 && dir[len] == 0) return h->cwds_index[i];
+    }
+  }
+  if (h->cwds_count >= (ssize_t)UINT32_MAX - 1) return 0;
+  if (h->cwds_count >= h->cwds_len) {
+    ssize_t newlen = (h->cwds_len <= 0 ? 8 : 2*h->cwds_len);
+    char** newcwds = mem_realloc_tp(h->mem, char*, h->cwds, newlen);
+    if (newcwds == NULL) return 0;
+    h->cwds = newcwds;
+    h->cwds_len = newlen;
+  }
+  if (2*(h->cwds_count + 1) > h->cwds_index_len) {
+    ssize_t newlen = (h->cwds_index_len <= 0 ? 16 : 2*h->cwds_index_len);
+    uint32_t* newindex = mem_zalloc_tp_n(h->mem, uint32_t, newlen);
+    if (newindex == NULL) return 0;
+    mem_free(h->mem, h->cwds_index);
+    h->cwds_index = newindex;
+    h->cwds_index_len = newlen;
+    for( ssize_t id = 1; id <= h->cwds_count; id++) {
+      const char* dir = h->cwds[id-1];
+      uint32_t i = history_cwd_hash(h, ic_strhash(dir));
+      while (h->cwds_index[i] != 0) { i = (i+1) & (uint32_t)(newlen - 1); }
+      h->cwds_index[i] = (uint32_t)id;
+    }
+  }
+  char* dir = mem_strndup(h->mem, cwd, len);
+  if (dir == NULL) return 0;
+  h->cwds[h->cwds_count++] = dir;
+  const uint32_t id = (uint32_t)h->cwds_count;
+  uint32_t i = history_cwd_hash(h,hash);
+  while (h->cwds_index[i] != 0) { i = (i+1) & (uint32_t)(h->cwds_index_len - 1); }
+  h->cwds_index[i] = id;
+  return id;
+}
+
+static const char* history_cwd( const history_t* h, uint32_t id ) {
+  return (id == 0 || id > (uint32_t)h->cwds_count ? NULL : h->cwds[id-1]);
+}
+
+static void tindex_add( history_t* h, ssize_t seq, const char* entry, ssize_t entry_len );
+static void sindex_free( history_t* h );
+static void history_found_clear( history_t* h );
+
+// append an entry at the end (without checking duplicates or the maximum)
+static bool history_append( history_t* h, const char* entry, ssize_t entry_len ) {
+  if (h->strings == NULL) {
+    h->strings = arena_new(h->mem);
+    if (h->strings == NULL) return false;
+  }
+  if (!history_ensure_chunk(h)) return false;
+  const char* e = arena_strndup(h->strings, entry, entry_len);
+  if (e == NULL) return false;
+  hchunk_t* c = history_chunk(h,h->next);
+  const ssize_t slot = h->next % IC_HISTORY_CHUNK;
+  c->elems[slot] = e;
+  c->live++;
+  if (c->meta != NULL) {
+    c->meta->time[slot] = 0;
+    c->meta->duration[slot] = 0;
+    c->meta->status[slot] = 0;
+    c->meta->cwd[slot] = 0;
+    c->meta->uses[slot] = 0;
+  }
+  if (h->sorted_next > h->next) { h->sorted_next = h->next; }  // reusing a removed sequence number
+  if (c->masked > slot) { c->masked = slot; }
+  tindex_add(h, h->next, e, entry_len);
+  history_found_clear(h);
+  h->next++;
+  h->count++;
+  h->strings_live += entry_len + 1;
+  return true;
+}
+
+
+//-------------------------------------------------------------
+// Hash index (linear probing)
+//-------------------------------------------------------------
+
+static void hindex_clear( history_t* h ) {
+  for( ssize_t i = 0; i < h->index_len; i++) {
+    h->index[i].seq = -1;
+  }
+}
+
+static void hindex_insert( history_t* h, ssize_t seq, uint32_t hash ) {
+  if (h->index == NULL) return;
+  const ssize_t mask = h->index_len - 1;
+  ssize_t i = (ssize_t)hash & mask;
+  while (h->index[i].seq >= 0) {
+    i = (i+1) & mask;
+  }
+  h->index[i].hash = hash;
+  h->index[i].seq  = seq;
+}
+
+static ssize_t hindex_find( const history_t* h, const char* entry, ssize_t entry_len, uint32_t hash ) {
+  if (h->index == NULL) return -1;
+  const ssize_t mask = h->index_len - 1;
+  for( ssize_t i = (ssize_t)hash & mask; h->index[i].seq >= 0; i = (i+1) & mask) {
+    if (h->index[i].hash != hash) continue;
+    const char* e = *history_slot(h,h->index[i].seq);
+    if (strncmp(e, entry, to_size_t(entry_len)) == 0 && e[entry_len] == 0) {
+      return h->index[i].seq;
+    }
+  }
+  return -1;
+}
+
+static void hindex_remove( history_t* h, ssize_t seq, uint32_t hash ) {
+  if (h->index == NULL) return;
+  const ssize_t mask = h->index_len - 1;
+  ssize_t i = (ssize_t)hash & mask;
+  while (h->index[i].seq != seq) {
+    if (h->index[i].seq < 0) return;  // not indexed (when duplicates are allowed)
+    i = (i+1) & mask;
+  }
+  // shift back following entries in the same cluster
+  ssize_t j = i;
+  while (true) {
+    j = (j+1) & mask;
+    if (h->index[j].seq < 0) break;
+    const ssize_t home = (ssize_t)h->index[j].hash & mask;
+    if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+      h->index[i] = h->index[j];
+      i = j;
+    }
+  }
+  h->index[i].seq = -1;
+}
+
+// (re)build the index; only the latest of any duplicate entries is indexed
+static void hindex_rebuild( history_t* h ) {
+  hindex_clear(h);
+  if (h->allow_duplicates) return;
+  for( ssize_t seq = h->first; seq < h->next; seq++) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL) continue;
+    const ssize_t len = ic_strlen(entry);
+    const uint32_t hash = ic_strnhash(entry, len);
+    const ssize_t prev = hindex_find(h, entry, len, hash);
+    if (prev >= 0) { hindex_remove(h, prev, hash); }
+    hindex_insert(h, seq, hash);
+  }
+}
+
+// ensure the index can hold `n` entries at a load factor of at most 1/2
+static bool hindex_reserve( history_t* h, ssize_t n ) {
+  if (2*n <= h->index_len) return true;
+  ssize_t newlen = (h->index_len <= 0 ? 64 : h->index_len);
+  while (newlen < 2*n) { newlen *= 2; }
+  hbucket_t* newindex = mem_malloc_tp_n(h->mem, hbucket_t, newlen);
+  if (newindex == NULL) return false;
+  mem_free(h->mem, h->index);
+  h->index = newindex;
+  h->index_len = newlen;
+  hindex_rebuild(h);
+  return true;
+}
+
+//-------------------------------------------------------------
+// Trigram index (linear probing)
+//-------------------------------------------------------------
+
+static ssize_t tindex_hash( const history_t* h, uint32_t tgram ) {
+  return (ssize_t)(((uint64_t)tgram * 0x9E3779B97F4A7C15ULL) >> 40) & (h->tindex_len - 1);
+}
+
+static uint32_t tgram_at( const char* s ) {
+  return (((uint32_t)(uint8_t)s[0] << 16) | ((uint32_t)(uint8_t)s[1] << 8) | (uint32_t)(uint8_t)s[2]);
+}
+
+static void tindex_free( history_t* h ) {
+  if (h->tindex == NULL) return;
+  for( ssize_t i = 0; i < h->tindex_len; i++) {
+    mem_free(h->mem, h->tindex[i].seqs);
+  }
+  mem_free(h->mem, h->tindex);
+  h->tindex = NULL;
+  h->tindex_len = 0;
+  h->tindex_count = 0;
+}
+
+static tpostings_t* tindex_find( const history_t* h, uint32_t tgram ) {
+  const ssize_t mask = h->tindex_len - 1;
+  for( ssize_t i = tindex_hash(h,tgram); h->tindex[i].tgram != 0; i = (i+1) & mask) {
+    if (h->tindex[i].tgram == tgram) return &h->tindex[i];
+  }
+  return NULL;
+}
+
+// find or insert the postings of a trigram
+static tpostings_t* tindex_lookup( history_t* h, uint32_t tgram ) {
+  if (2*(h->tindex_count + 1) > h->tindex_len) {
+    // grow
+    ssize_t newlen = (h->tindex_len <= 0 ? 1024 : 2*h->tindex_len);
+    tpostings_t* newindex = mem_zalloc_tp_n(h->mem, tpostings_t, newlen);
+    if (newindex == NULL) return NULL;
+    tpostings_t* old = h->tindex;
+    const ssize_t oldlen = h->tindex_len;
+    h->tindex = newindex;
+    h->tindex_len = newlen;
+    for( ssize_t i = 0; i < oldlen; i++) {
+      if (old[i].tgram == 0) continue;
+      ssize_t j = tindex_hash(h, old[i].tgram);
+      while (h->tindex[j].tgram != 0) { j = (j+1) & (newlen - 1); }
+      h->tindex[j] = old[i];
+    }
+    mem_free(h->mem, old);
+  }
+  const ssize_t mask = h->tindex_len - 1;
+  ssize_t i = tindex_hash(h,tgram);
+  while (h->tindex[i].tgram != 0) {
+    if (h->tindex[i].tgram == tgram) return &h->tindex[i];
+    i = (i+1) & mask;
+  }
+  h->tindex[i].tgram = tgram;
+  h->tindex_count++;
+  return &h->tindex[i];
+}
+
+static bool tpostings_add( history_t* h, tpostings_t* t, uint32_t seq ) {
+  // postings at or after `seq` belong to removed entries
+  while (t->len > 0 && t->seqs[t->len-1] >= seq) { t->len--; }
+  if (t->len >= t->cap) {
+    // drop postings of entries that were dropped from the front
+    ssize_t lo = 0;
+    ssize_t hi = t->len;
+    while (lo < hi) {
+      ssize_t mid = (lo + hi)/2;
+      if ((ssize_t)t->seqs[mid] < h->first) lo = mid + 1; else hi = mid;
+    }
+    if (lo > 0) {
+      ic_memmove(t->seqs, t->seqs + lo, ((ssize_t)t->len - lo)*ssizeof(uint32_t));
+      t->len -= (uint32_t)lo;
+    }
+  }
+  if (t->len >= t->cap) {
+    uint32_t newcap = (t->cap == 0 ? 4 : 2*t->cap);
+    uint32_t* newseqs = mem_realloc_tp(h->mem, uint32_t, t->seqs, newcap);
+    if (newseqs == NULL) return false;
+    t->seqs = newseqs;
+    t->cap = newcap;
+  }
+  t->seqs[t->len++] = seq;
+  return true;
+}
+
+static void tindex_add( history_t* h, ssize_t seq, const char* entry, ssize_t entry_len ) {
+  if (h->tindex == NULL) return;
+  if (seq > (ssize_t)UINT32_MAX) { tindex_free(h); return; }
+  for( ssize_t i = 0; i + 3 <= entry_len; i++) {
+    tpostings_t* t = tindex_lookup(h, tgram_at(entry + i));
+    if (t == NULL || !tpostings_add(h, t, (uint32_t)seq)) {
+      tindex_free(h);  // out of memory: search without index
+      return;
+    }
+  }
+}
+
+// build the trigram index on demand
+static bool tindex_ensure( history_t* h ) {
+  if (h->tindex != NULL) return true;
+  if (h->next > (ssize_t)UINT32_MAX) return false;
+  h->tindex = mem_zalloc_tp_n(h->mem, tpostings_t, 1024);
+  if (h->tindex == NULL) return false;
+  h->tindex_len = 1024;
+  for( ssize_t seq = h->first; h->tindex != NULL && seq < h->next; seq++) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL) continue;
+    tindex_add(h, seq, entry, ic_strlen(entry));
+  }
+  return (h->tindex != NULL);
+}
+
+
+//-------------------------------------------------------------
+// Sorted prefix index
+//-------------------------------------------------------------
+
+static void hrank_free( history_t* h ) {
+  mem_free(h->mem, h->rank);
+  mem_free(h->mem, h->rank_tree);
+  h->rank = NULL;
+  h->rank_tree = NULL;
+}
+
+static void sindex_free( history_t* h ) {
+  hrank_free(h);
+  mem_free(h->mem, h->sorted);
+  h->sorted = NULL;
+  h->sorted_count = 0;
+  h->sorted_next = 0;
+}
+
+static bool sindex_valid( const history_t* h, const hsorted_t* e ) {
+  return (e->seq >= h->first && e->seq < h->sorted_next && e->seq < h->next && 
+          *history_slot(h,e->seq) == e->entry);
+}
+
+static int sindex_compare( const void* p1, const void* p2 ) {
+  const hsorted_t* e1 = (const hsorted_t*)p1;
+  const hsorted_t* e2 = (const hsorted_t*)p2;
+  int c = strcmp(e1->entry, e2->entry);
+  if (c != 0) return c;
+  return (e1->seq < e2->seq ? -1 : (e1->seq > e2->seq ? 1 : 0));
+}
+
+// index of the first sorted entry not less than `prefix` (or greater if `upper`)
+static ssize_t sindex_bound( const history_t* h, const char* prefix, ssize_t prefix_len, bool upper ) {
+  ssize_t lo = 0;
+  ssize_t hi = h->sorted_count;
+  while (lo < hi) {
+    ssize_t mid = (lo + hi)/2;
+    int c = strncmp(h->sorted[mid].entry, prefix, to_size_t(prefix_len));
+    if (c < 0 || (upper && c == 0)) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+// Merge the pending entries into the sorted index (building it on first use)
+// once there are too many of them to scan. Removed entries are dropped on a merge.
+static bool sindex_ensure( history_t* h ) {
+  if (h->sorted_next < h->first) { h->sorted_next = h->first; }
+  if (h->sorted != NULL && h->next - h->sorted_next <= IC_HISTORY_SORTED_PENDING) return true;
+  // sort the pending entries
+  ssize_t n = 0;
+  hsorted_t* pending = mem_malloc_tp_n(h->mem, hsorted_t, h->next - h->sorted_next + 1);
+  if (pending == NULL) return false;
+  for( ssize_t seq = h->sorted_next; seq < h->next; seq++) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL) continue;
+    pending[n].entry = entry;
+    pending[n].seq = seq;
+    n++;
+  }
+  qsort(pending, to_size_t(n), sizeof(hsorted_t), &sindex_compare);
+  // and merge them with the valid entries of the current index
+  hsorted_t* sorted = mem_malloc_tp_n(h->mem, hsorted_t, h->sorted_count + n + 1);
+  if (sorted == NULL) { mem_free(h->mem, pending); return false; }
+  ssize_t count = 0;
+  ssize_t i = 0;
+  for( ssize_t j = 0; j <= n; j++) {
+    // copy the current entries before pending[j]
+    const ssize_t end = (j < n ? sindex_bound(h, pending[j].entry, ic_strlen(pending[j].entry) + 1, false) : h->sorted_count);
+    for( ; i < end; i++) {
+      if (sindex_valid(h, &h->sorted[i])) { sorted[count++] = h->sorted[i]; }
+    }
+    if (j < n) { sorted[count++] = pending[j]; }
+  }
+  mem_free(h->mem, pending);
+  mem_free(h->mem, h->sorted);
+  hrank_free(h);  // positions changed; rebuilt on the next hint
+  h->sorted = sorted;
+  h->sorted_count = count;
+  h->sorted_next = h->next;
+  return true;
+}
+
+
+//-------------------------------------------------------------
+// Frecency ranking of the sorted index
+//-------------------------------------------------------------
+
+// Frecency as `log2(uses) + time/half_life` (the logarithm of `uses * 2^(-age/half_life)`
+// without the term for the current time). Entries without a time rank below those with one.
+static double history_frecency( const history_t* h, ssize_t seq ) {
+  hmeta_t m;
+  history_meta_get(h, seq, &m);
+  double lg = 0.0;  // piecewise linear approximation of log2(uses) 
+  if (m.uses > 1) {
+    uint32_t k = 0;
+    while ((m.uses >> (k+1)) != 0) { k++; }
+    lg = (double)k + (double)(m.uses - (1U << k)) / (double)(1U << k);
+  }
+  return lg + (double)m.time / (double)IC_HISTORY_HALF_LIFE;
+}
+
+// the better ranked of two sorted positions (or -1); ties are won by the latest entry
+static ssize_t hrank_better( const history_t* h, ssize_t i, ssize_t j ) {
+  if (i < 0) return j;
+  if (j < 0) return i;
+  if (h->rank[i] != h->rank[j]) return (h->rank[i] > h->rank[j] ? i : j);
+  return (h->sorted[i].seq > h->sorted[j].seq ? i : j);
+}
+
+static bool hrank_ensure( history_t* h ) {
+  if (!sindex_ensure(h)) return false;
+  if (h->rank != NULL) return true;
+  const ssize_t n = h->sorted_count;
+  h->rank = mem_malloc_tp_n(h->mem, double, n + 1);
+  h->rank_tree = mem_malloc_tp_n(h->mem, uint32_t, 2*n + 1);
+  if (h->rank == NULL || h->rank_tree == NULL) { hrank_free(h); return false; }
+  for( ssize_t i = 0; i < n; i++) {
+    h->rank[i] = (sindex_valid(h, &h->sorted[i]) ? history_frecency(h, h->sorted[i].seq) : -DBL_MAX);
+    h->rank_tree[n + i] = (uint32_t)i;
+  }
+  for( ssize_t i = n - 1; i > 0; i--) {
+    h->rank_tree[i] = (uint32_t)hrank_better(h, h->rank_tree[2*i], h->rank_tree[2*i+1]);
+  }
+  return true;
+}
+
+static void hrank_set( history_t* h, ssize_t i, double rank ) {
+  h->rank[i] = rank;
+  for( ssize_t p = (h->sorted_count + i)/2; p > 0; p /= 2) {
+    h->rank_tree[p] = (uint32_t)hrank_better(h, h->rank_tree[2*p], h->rank_tree[2*p+1]);
+  }
+}
+
+// the sorted position of the entry with sequence number `seq` (or -1)
+static ssize_t hrank_position( const history_t* h, ssize_t seq ) {
+  const char* entry = *history_slot(h,seq);
+  if (entry == NULL) return -1;
+  for( ssize_t i = sindex_bound(h, entry, ic_strlen(entry) + 1, false); 
+       i < h->sorted_count && strcmp(h->sorted[i].entry, entry) == 0; i++) {
+    if (h->sorted[i].seq == seq) return i;
+  }
+  return -1;
+}
+
+// the metadata of an entry changed
+static void hrank_update( history_t* h, ssize_t seq ) {
+  if (h->rank == NULL || seq >= h->sorted_next) return;
+  const ssize_t i = hrank_position(h, seq);
+  if (i >= 0) { hrank_set(h, i, history_frecency(h, seq)); }
+}
+
+// the best ranked sorted position in `[lo,hi)` (or -1)
+static ssize_t hrank_query( const history_t* h, ssize_t lo, ssize_t hi ) {
+  ssize_t best = -1;
+  for( ssize_t l = lo + h->sorted_count, r = hi + h->sorted_count; l < r; l /= 2, r /= 2) {
+    if (l & 1) { best = hrank_better(h, best, h->rank_tree[l++]); }
+    if (r & 1) { best = hrank_better(h, best, h->rank_tree[--r]); }
+  }
+  return (best < 0 || h->rank[best] == -DBL_MAX ? -1 : best);
+}
+
+static void history_found_clear( history_t* h ) {
+  if (h->found_query == NULL) return;
+  mem_free(h->mem, h->found_query);
+  h->found_query = NULL;
+  h->found_count = 0;
+}
+
+static bool history_found_add( history_t* h, ssize_t seq ) {
+  if (h->found_count >= h->found_len) {
+    ssize_t newlen = (h->found_len <= 0 ? 64 : 2*h->found_len);
+    uint32_t* newfound = mem_realloc_tp(h->mem, uint32_t, h->found, newlen);
+    if (newfound == NULL) return false;
+    h->found = newfound;
+    h->found_len = newlen;
+  }
+  h->found[h->found_count++] = (uint32_t)seq;
+  return true;
+}
+
+// Find all entries that contain `search` into `found`. If the query refines the
+// previous one, only the previous matches are considered; otherwise only the
+// entries in the postings of the rarest trigram of the query.
+// Returns false if the index cannot be used (e.g. for queries shorter than a trigram).
+static bool history_found_update( history_t* h, const char* search ) {
+  const ssize_t search_len = ic_strlen(search);
+  if (search_len < 3) return false;
+  if (h->found_query != NULL && !h->found_prefix && strstr(search, h->found_query) != NULL) {
+    if (strcmp(search, h->found_query) == 0) return true;
+    // refine the previous matches in place
+    ssize_t n = 0;
+    for( ssize_t i = 0; i < h->found_count; i++) {
+      if (strstr(*history_slot(h,h->found[i]), search) != NULL) { h->found[n++] = h->found[i]; }
+    }
+    h->found_count = n;
+  }
+  else {
+    history_found_clear(h);
+    if (!tindex_ensure(h)) return false;
+    const tpostings_t* rarest = NULL;
+    for( ssize_t i = 0; i + 3 <= search_len; i++) {
+      const tpostings_t* t = tindex_find(h, tgram_at(search + i));
+      if (t == NULL) { rarest = NULL; break; }  // no entry contains this trigram
+      if (rarest == NULL || t->len < rarest->len) rarest = t;
+    }
+    h->found_count = 0;
+    for( uint32_t i = 0; rarest != NULL && i < rarest->len; i++) {
+      const ssize_t seq = rarest->seqs[i];
+      if (seq < h->first || seq >= h->next) continue;
+      const char* entry = *history_slot(h,seq);
+      if (entry == NULL || strstr(entry, search) == NULL) continue;
+      if (!history_found_add(h, seq)) return false;
+    }
+  }
+  mem_free(h->mem, h->found_query);
+  h->found_query = mem_strdup(h->mem, search);
+  h->found_prefix = false;
+  return (h->found_query != NULL);
+}
+
+static int history_seq_compare( const void* p1, const void* p2 ) {
+  const uint32_t s1 = *((const uint32_t*)p1);
+  const uint32_t s2 = *((const uint32_t*)p2);
+  return (s1 < s2 ? -1 : (s1 > s2 ? 1 : 0));
+}
+
+// Find all entries that start with `prefix` into `found` using the sorted index.
+// Returns false if the index is not worth it as most entries match (or for the empty prefix).
+static bool history_found_update_prefix( history_t* h, const char* prefix ) {
+  const ssize_t prefix_len = ic_strlen(prefix);
+  if (prefix_len <= 0) return false;
+  if (h->found_query != NULL && h->found_prefix && ic_starts_with(prefix, h->found_query)) {
+    if (strcmp(prefix, h->found_query) == 0) return true;
+    // refine the previous matches in place
+    ssize_t n = 0;
+    for( ssize_t i = 0; i < h->found_count; i++) {
+      if (ic_starts_with(*history_slot(h,h->found[i]), prefix)) { h->found[n++] = h->found[i]; }
+    }
+    h->found_count = n;
+  }
+  else {
+    history_found_clear(h);
+    if (h->next > (ssize_t)UINT32_MAX || !sindex_ensure(h)) return false;
+    const ssize_t lo = sindex_bound(h, prefix, prefix_len, false);
+    const ssize_t hi = sindex_bound(h, prefix, prefix_len, true);
+    if (8*(hi - lo) > h->count) return false;  // a plain scan finds the next match quickly
+    h->found_count = 0;
+    for( ssize_t i = lo; i < hi; i++) {
+      if (!sindex_valid(h, &h->sorted[i])) continue;
+      if (!history_found_add(h, h->sorted[i].seq)) return false;
+    }
+    for( ssize_t seq = h->sorted_next; seq < h->next; seq++) {
+      const char* entry = *history_slot(h,seq);
+      if (entry == NULL || !ic_starts_with(entry, prefix)) continue;
+      if (!history_found_add(h, seq)) return false;
+    }
+    if (h->found_count > 1) {
+      qsort(h->found, to_size_t(h->found_count), sizeof(uint32_t), &history_seq_compare);
+    }
+  }
+  mem_free(h->mem, h->found_query);
+  h->found_query = mem_strdup(h->mem, prefix);
+  h->found_prefix = true;
+  return (h->found_query != NULL);
+}
+
+ic_private bool history_enable_journal( history_t* h, bool enable ) {
+  bool prev = h->journal;
+  h->journal = enable;
+  return prev;
+}
+
+ic_private bool history_enable_shared( history_t* h, bool enable ) {
+  bool prev = h->shared;
+  h->shared = enable;
+  return prev;
+}
+
+ic_private bool history_enable_journal_sync( history_t* h, bool enable ) {
+  bool prev = h->journal_sync;
+  h->journal_sync = enable;
+  return prev;
+}
+
 ic_private bool history_enable_duplicates( history_t* h, bool enable ) {
   bool prev = h->allow_duplicates;
   h->allow_duplicates = enable;
+  if (prev != enable) { hindex_rebuild(h); }
   return prev;
 }
 
-ic_private ssize_t  history_count(const history_t* h) {
-  return h->count;
-}
 
 //-------------------------------------------------------------
 // push/clear
@@ -59,39 +856,101 @@ ic_private ssize_t  history_count(const history_t* h) {
 
 ic_private bool history_update( history_t* h, const char* entry ) {
   if (entry==NULL) return false;
+  if (h->count > 0 && strcmp(*history_slot(h,h->next-1), entry) == 0) return true;  // keep its metadata
   history_remove_last(h);
   history_push(h,entry);
-  //debug_msg("history: update: with %s; now at %s\n", entry, history_get(h,0));
   return true;
 }
 
-static void history_delete_at( history_t* h, ssize_t idx ) {
-  if (idx < 0 || idx >= h->count) return;
-  mem_free(h->mem, h->elems[idx]);
-  for(ssize_t i = idx+1; i < h->count; i++) {
-    h->elems[i-1] = h->elems[i];
+static void history_delete_seq( history_t* h, ssize_t seq ) {
+  const char** slot = history_slot(h,seq);
+  if (*slot == NULL) return;
+  if (!h->allow_duplicates) {
+    hindex_remove(h, seq, ic_strhash(*slot));
   }
+  h->strings_live -= ic_strlen(*slot) + 1;
+  *slot = NULL;
+  history_found_clear(h);
+  history_chunk(h,seq)->live--;
   h->count--;
+  // trim empty slots at either end
+  while (h->first < h->next && *history_slot(h,h->first) == NULL) { h->first++; }
+  while (h->next > h->first && *history_slot(h,h->next-1) == NULL) { h->next--; }
+  if (h->saved_next > h->next) { 
+    h->saved_next = h->next; 
+    h->file_tail_ours = false;
+  }
+  history_free_old_chunks(h);
+}
+
+// move all entries in use into fresh chunks and a fresh arena
+static void history_compact( history_t* h ) {
+  tindex_free(h);  // sequence numbers change; rebuilt on the next search
+  sindex_free(h);
+  history_found_clear(h);
+  history_t old = *h;
+  h->chunks = NULL;
+  h->chunk_count = h->chunk_len = 0;
+  h->count = h->first = h->next = 0;
+  h->strings = NULL;
+  h->strings_live = 0;
+  h->saved_next = 0;
+  bool ok = true;
+  for( ssize_t seq = old.first; ok && seq < old.next; seq++) {
+    const char* entry = *history_slot(&old,seq);
+    if (entry == NULL) continue;
+    ok = history_append(h, entry, ic_strlen(entry));
+    if (ok) {
+      hmeta_t m;
+      history_meta_get(&old, seq, &m);
+      ok = history_meta_put(h, h->next - 1, &m);
+    }
+    if (seq < old.saved_next) { h->saved_next = h->next; }
+  }
+  history_t* discard = (ok ? &old : h);
+  for( ssize_t i = 0; i < discard->chunk_count; i++) {
+    history_chunk_free(h, discard->chunks[i]);
+  }
+  mem_free(h->mem, discard->chunks);
+  arena_free(discard->strings);
+  if (!ok) { *h = old; return; }  // out of memory: keep as is
+  hindex_rebuild(h);
 }
 
 ic_private bool history_push( history_t* h, const char* entry ) {
   if (h->len <= 0 || entry==NULL)  return false;
-  // remove any older duplicate
+  const ssize_t len = ic_strlen(entry);
+  const uint32_t hash = ic_strnhash(entry, len);
+  // remove any older duplicate (but remember how often it was used)
+  uint32_t uses = 0;
   if (!h->allow_duplicates) {
-    for( int i = 0; i < h->count; i++) {
-      if (strcmp(h->elems[i],entry) == 0) {
-        history_delete_at(h,i);
-      }
+    ssize_t seq = hindex_find(h, entry, len, hash);
+    if (seq >= 0) {
+      hmeta_t m;
+      history_meta_get(h, seq, &m);
+      uses = (m.uses <= 1 ? 2 : (m.uses == UINT32_MAX ? m.uses : m.uses + 1));
+      if (seq < h->saved_next) { h->file_displaced = true; }
+      history_delete_seq(h,seq);
     }
   }
-  // insert at front
-  if (h->count == h->len) {
-    // delete oldest entry
-    history_delete_at(h,0);    
+  // delete oldest entry
+  if (h->count >= h->len) {
+    history_delete_seq(h,h->first);    
+  }
+  // reclaim space if more than half is unused
+  if ((h->next - h->first) - h->count > h->count + IC_HISTORY_CHUNK ||
+      arena_used(h->strings) - h->strings_live > h->strings_live + 64*1024) {
+    history_compact(h);
+  }
+  if (!hindex_reserve(h, h->count + 1)) return false;
+  if (!history_append(h, entry, len)) return false;
+  if (!h->allow_duplicates) {
+    hindex_insert(h, h->next - 1, hash);
+  }
+  if (uses > 0) {
+    hmeta_t m = { 0, 0, 0, 0, uses };
+    history_meta_put(h, h->next - 1, &m);
   }
-  assert(h->count < h->len);
-  h->elems[h->count] = mem_strdup(h->mem,entry);
-  h->count++;
   return true;
 }
 
@@ -99,10 +958,12 @@ ic_private bool history_push( history_t* h, const char* entry ) {
 static void history_remove_last_n( history_t* h, ssize_t n ) {
   if (n <= 0) return;
   if (n > h->count) n = h->count;
-  for( ssize_t i = h->count - n; i < h->count; i++) {
-    mem_free( h->mem, h->elems[i] );
+  for( ssize_t i = 0; i < n; i++) {
+    if (h->next - 1 < h->saved_next || h->file_displaced) {
+      h->file_stale = true;  // removing a saved entry (or one that replaced a saved entry)
+    }
+    history_delete_seq( h, h->next - 1 );  // the last slot is always in use
   }
-  h->count -= n;
   assert(h->count >= 0);    
 }
 
@@ -111,50 +972,297 @@ ic_private void history_remove_last(history_t* h) {
 }
 
 ic_private void history_clear(history_t* h) {
-  history_remove_last_n( h, h->count );
+  for( ssize_t i = 0; i < h->chunk_count; i++) {
+    history_chunk_free(h, h->chunks[i]);
+  }
+  h->chunk_count = 0;
+  h->count = h->first = h->next = 0;
+  h->saved_next = 0;
+  h->file_stale = (h->file_entries > 0);
+  h->file_tail_ours = false;
+  h->meta_pending = false;
+  sindex_free(h);
+  arena_reset(h->strings);
+  h->strings_live = 0;
+  hindex_clear(h);
+  tindex_free(h);
+  history_found_clear(h);
+}
+
+// sequence number of the n'th last entry
+static ssize_t history_seq_at( const history_t* h, ssize_t n ) {
+  if (n < 0 || n >= h->count) return -1;
+  if (h->next - h->first == h->count) {
+    return (h->next - n - 1);  // no removed slots
+  }
+  // skip whole chunks using their live count
+  for( ssize_t ci = h->chunk_count - 1; ci >= 0; ci-- ) {
+    const hchunk_t* c = h->chunks[ci];
+    if (n >= c->live) {
+      n -= c->live;
+      continue;
+    }
+    for( ssize_t i = IC_HISTORY_CHUNK - 1; i >= 0; i--) {
+      if (c->elems[i] != NULL) {
+        if (n == 0) return ((h->chunk_first + ci)*IC_HISTORY_CHUNK + i);
+        n--;
+      }
+    }
+  }
+  assert(false);
+  return -1;
 }
 
 ic_private const char* history_get( const history_t* h, ssize_t n ) {
-  if (n < 0 || n >= h->count) return NULL;
-  return h->elems[h->count - n - 1];
+  ssize_t seq = history_seq_at(h,n);
+  if (seq < 0) return NULL;
+  return *history_slot(h,seq);
+}
+
+// update the metadata of an entry; metadata of saved entries needs to be saved again
+static bool history_meta_update( history_t* h, ssize_t seq, const hmeta_t* m ) {
+  if (!history_meta_put(h, seq, m)) return false;
+  if (seq < h->saved_next) {
+    if (seq == h->saved_next - 1) { h->meta_pending = true; }  // appended on the next save
+                             else { h->file_stale = true; }
+  }
+  return true;
 }
 
-ic_private bool history_search( const history_t* h, ssize_t from /*including*/, const char* search, bool backward, ssize_t* hidx, ssize_t* hpos ) {
+ic_private bool history_set_time( history_t* h, ssize_t n, int64_t time ) {
+  ssize_t seq = history_seq_at(h,n);
+  if (seq < 0) return false;
+  hmeta_t m;
+  history_meta_get(h, seq, &m);
+  m.time = time;
+  return history_meta_update(h, seq, &m);
+}
+
+ic_private bool history_set_meta( history_t* h, ssize_t n, long duration, int status, const char* cwd ) {
+  ssize_t seq = history_seq_at(h,n);
+  if (seq < 0) return false;
+  hmeta_t m;
+  history_meta_get(h, seq, &m);
+  m.duration = (duration <= 0 ? 0 : ((unsigned long)duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration));
+  m.status = status;
+  m.cwd = history_cwd_intern(h, cwd, (cwd == NULL ? 0 : ic_strlen(cwd)));
+  return history_meta_update(h, seq, &m);
+}
+
+ic_private const char* history_get_meta( const history_t* h, ssize_t n, int64_t* time, long* duration, int* status, const char** cwd ) {
+  ssize_t seq = history_seq_at(h,n);
+  if (seq < 0) return NULL;
+  hmeta_t m;
+  history_meta_get(h, seq, &m);
+  if (time != NULL) { *time = m.time; }
+  if (duration != NULL) { *duration = (long)m.duration; }
+  if (status != NULL) { *status = m.status; }
+  if (cwd != NULL) { *cwd = history_cwd(h, m.cwd); }
+  return *history_slot(h,seq);
+}
+
+// index of the entry with sequence number `seq` (counting back from the last entry)
+static ssize_t history_index_of( const history_t* h, ssize_t seq ) {
+  if (h->next - h->first == h->count) {
+    return (h->next - seq - 1);  // no removed slots
+  }
+  const ssize_t cseq = seq/IC_HISTORY_CHUNK - h->chunk_first;
+  ssize_t n = 0;
+  for( ssize_t ci = h->chunk_count - 1; ci > cseq; ci-- ) {
+    n += h->chunks[ci]->live;
+  }
+  const hchunk_t* c = h->chunks[cseq];
+  for( ssize_t i = IC_HISTORY_CHUNK - 1; i > seq % IC_HISTORY_CHUNK; i--) {
+    if (c->elems[i] != NULL) n++;
+  }
+  return n;
+}
+
+// binary search the found matches for the first one from `seq` on (in the search direction)
+static ssize_t history_found_from( const history_t* h, ssize_t seq, bool backward ) {
+  ssize_t lo = 0;
+  ssize_t hi = h->found_count;
+  while (lo < hi) {
+    ssize_t mid = (lo + hi)/2;
+    if ((ssize_t)h->found[mid] < seq + (backward ? 1 : 0)) lo = mid + 1; else hi = mid;
+  }
+  const ssize_t k = (backward ? lo - 1 : lo);
+  return (k < 0 || k >= h->found_count ? -1 : (ssize_t)h->found[k]);
+}
+
+ic_private bool history_search( history_t* h, ssize_t from /*including*/, const char* search, bool backward, ssize_t* hidx, ssize_t* hpos ) {
   const char* p = NULL;
-  ssize_t i;
-  if (backward) {
-    for( i = from; i < h->count; i++ ) {
-      p = strstr( history_get(h,i), search);
-      if (p != NULL) break;
+  const char* entry = NULL;
+  ssize_t i = from;
+  ssize_t seq = history_seq_at(h,from);
+  if (seq < 0) return false;
+  if (history_found_update(h, search)) {
+    seq = history_found_from(h, seq, backward);
+    if (seq < 0) return false;
+    entry = *history_slot(h,seq);
+    p = strstr(entry, search);
+    i = history_index_of(h,seq);
+  }
+  else {
+    while (true) {
+      entry = *history_slot(h,seq);
+      if (entry != NULL) {
+        p = strstr(entry, search);
+        if (p != NULL) break;
+        i += (backward ? 1 : -1);
+      }
+      // visit the previous entries going backward, and the next entries going forward
+      seq += (backward ? -1 : 1);
+      if (seq < h->first || seq >= h->next) return false;
     }
   }
+  if (hidx != NULL) *hidx = i;
+  if (hpos != NULL) *hpos = (p - entry);
+  return true;
+}
+
+// Find the first entry from `from` on (in the search direction) that starts with `prefix`.
+ic_private bool history_prefix_search( history_t* h, ssize_t from /*including*/, const char* prefix, bool backward, ssize_t* hidx ) {
+  ssize_t i = from;
+  ssize_t seq = history_seq_at(h,from);
+  if (seq < 0) return false;
+  if (history_found_update_prefix(h, prefix)) {
+    seq = history_found_from(h, seq, backward);
+    if (seq < 0) return false;
+    i = history_index_of(h,seq);
+  }
   else {
-    for( i = from; i >= 0; i-- ) {
-      p = strstr( history_get(h,i), search);
-      if (p != NULL) break;
+    while (true) {
+      const char* entry = *history_slot(h,seq);
+      if (entry != NULL) {
+        if (ic_starts_with(entry, prefix)) break;
+        i += (backward ? 1 : -1);
+      }
+      seq += (backward ? -1 : 1);
+      if (seq < h->first || seq >= h->next) return false;
     }
   }
-  if (p == NULL) return false;
   if (hidx != NULL) *hidx = i;
-  if (hpos != NULL) *hpos = (p - history_get(h,i));
+  return true;
+}
+
+// Find the entry with the highest frecency that starts with `prefix` and is longer than it, 
+// ignoring the entry at index `skip` (usually the one being edited).
+ic_private bool history_frecent_search( history_t* h, const char* prefix, ssize_t skip, ssize_t* hidx ) {
+  const ssize_t prefix_len = ic_strlen(prefix);
+  if (prefix_len <= 0 || h->next > (ssize_t)UINT32_MAX || !hrank_ensure(h)) return false;
+  const ssize_t skip_seq = history_seq_at(h,skip);
+  ssize_t lo = sindex_bound(h, prefix, prefix_len, false);
+  const ssize_t hi = sindex_bound(h, prefix, prefix_len, true);
+  // entries equal to the prefix sort first
+  ssize_t n = hi;
+  while (lo < n) {
+    ssize_t mid = (lo + n)/2;
+    if (h->sorted[mid].entry[prefix_len] == 0) lo = mid + 1; else n = mid;
+  }
+  // best indexed entry; entries that were removed since are dropped on the way
+  const ssize_t skip_pos = (skip_seq >= 0 && skip_seq < h->sorted_next ? hrank_position(h, skip_seq) : -1);
+  ssize_t best = -1;
+  do {
+    if (best >= 0) { hrank_set(h, best, -DBL_MAX); }
+    if (skip_pos >= lo && skip_pos < hi) {
+      best = hrank_better(h, hrank_query(h, lo, skip_pos), hrank_query(h, skip_pos + 1, hi));
+    }
+    else {
+      best = hrank_query(h, lo, hi);
+    }
+  } while (best >= 0 && !sindex_valid(h, &h->sorted[best]));
+  ssize_t best_seq = (best < 0 ? -1 : h->sorted[best].seq);
+  double best_rank = (best < 0 ? -DBL_MAX : h->rank[best]);
+  // and the pending entries
+  for( ssize_t seq = h->sorted_next; seq < h->next; seq++) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL || seq == skip_seq || !ic_starts_with(entry, prefix) || entry[prefix_len] == 0) continue;
+    const double rank = history_frecency(h, seq);
+    if (best_seq < 0 || rank >= best_rank) {
+      best_seq = seq;
+      best_rank = rank;
+    }
+  }
+  if (best_seq < 0) return false;
+  if (hidx != NULL) *hidx = history_index_of(h,best_seq);
   return true;
 }
 
 //-------------------------------------------------------------
-// 
+// Fuzzy search
 //-------------------------------------------------------------
 
+// compute missing character masks of a chunk
+static void history_chunk_masks( history_t* h, ssize_t ci ) {
+  hchunk_t* c = h->chunks[ci];
+  const ssize_t base = (h->chunk_first + ci)*IC_HISTORY_CHUNK;
+  const ssize_t used = (h->next - base < IC_HISTORY_CHUNK ? h->next - base : IC_HISTORY_CHUNK);
+  for( ssize_t i = c->masked; i < used; i++) {
+    const char* entry = c->elems[i];
+    c->masks[i] = (entry == NULL ? 0 : fuzzy_charmask(entry, ic_strlen(entry)));
+  }
+  if (used > c->masked) { c->masked = used; }
+}
+
+// Find the `max` best fuzzy matches for `query`, best first, and return their indices in `hidxs`.
+// Index 0 is skipped as it is the input being edited (as in the substring search).
+// The character masks are checked first for all entries in a chunk at once
+// in a simple loop that compilers vectorize; only entries that pass are scored.
+ic_private ssize_t history_fuzzy_search( history_t* h, const char* query, ssize_t* hidxs, ssize_t max ) {
+  if (max <= 0 || query == NULL) return 0;
+  const ssize_t query_len = ic_strlen(query);
+  const uint64_t qmask = fuzzy_charmask(query, query_len);
+  fuzzy_match_t* heap = mem_malloc_tp_n(h->mem, fuzzy_match_t, max);
+  if (heap == NULL) return 0;
+  ssize_t count = 0;
+  const ssize_t current = history_seq_at(h, 0);  // the input being edited
+  uint8_t pass[IC_HISTORY_CHUNK];
+  for( ssize_t ci = 0; ci < h->chunk_count; ci++) {
+    const hchunk_t* c = h->chunks[ci];
+    if (c->live == 0) continue;
+    history_chunk_masks(h, ci);
+    for( ssize_t i = 0; i < IC_HISTORY_CHUNK; i++) {
+      pass[i] = ((c->masks[i] & qmask) == qmask);
+    }
+    const ssize_t base = (h->chunk_first + ci)*IC_HISTORY_CHUNK;
+    for( ssize_t i = 0; i < c->masked; i++) {
+      const char* entry = c->elems[i];
+      if (!pass[i] || entry == NULL || base + i == current) continue;
+      const int score = fuzzy_score(query, query_len, entry, ic_strlen(entry), NULL);
+      if (score >= 0) { fuzzy_top_push(heap, &count, max, score, base + i); }  // on equal scores the latest entry is better
+    }
+  }
+  // pop the heap from worst to best
+  const ssize_t n = count;
+  while (count > 0) {
+    const ssize_t seq = fuzzy_top_pop(heap, &count);
+    hidxs[count] = history_index_of(h, seq);
+  }
+  mem_free(h->mem, heap);
+  return n;
+}
+
+static void history_forget_file( history_t* h ) {
+  h->file_entries = 0;
+  h->file_offset = 0;
+  h->file_mtime = 0;
+  h->file_ino = 0;
+  h->file_dev = 0;
+  h->file_mark_len = 0;
+  h->file_tail_ours = false;
+  h->meta_pending = false;
+  h->file_stale = false;
+  h->file_displaced = false;
+}
+
 ic_private void history_load_from(history_t* h, const char* fname, long max_entries ) {
   history_clear(h);
+  history_forget_file(h);
+  mem_free(h->mem, h->fname);
   h->fname = mem_strdup(h->mem,fname);
-  if (max_entries == 0) {
-    assert(h->elems == NULL);
-    return;
-  }
-  if (max_entries < 0 || max_entries > IC_MAX_HISTORY) max_entries = IC_MAX_HISTORY;
-  h->elems = (const char**)mem_zalloc_tp_n(h->mem, char*, max_entries );
-  if (h->elems == NULL) return;
-  h->len = max_entries;
+  h->len = (max_entries < 0 ? IC_DEFAULT_HISTORY : max_entries);
+  if (h->len == 0) return;
   history_load(h);
 }
 
@@ -182,36 +1290,35 @@ static bool ic_isxdigit( int c ) {
   return ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || (c >= '0' && c <= '9'));
 }
 
-static bool history_read_entry( history_t* h, FILE* f, stringbuf_t* sbuf ) {
+// decode an entry from the history file into `sbuf`
+static bool history_decode_entry( const char* s, ssize_t len, stringbuf_t* sbuf ) {
   sbuf_clear(sbuf);
-  while( !feof(f)) {
-    int c = fgetc(f);
-    if (c == EOF || c == '\n') break;
-    if (c == '\\') {
-      c = fgetc(f);
-      if (c == 'n')       { sbuf_append(sbuf,"\n"); }
-      else if (c == 'r')  { /* ignore */ }  // sbuf_append(sbuf,"\r");
-      else if (c == 't')  { sbuf_append(sbuf,"\t"); }
-      else if (c == '\\') { sbuf_append(sbuf,"\\"); }
-      else if (c == 'x') {
-        int c1 = fgetc(f);         
-        int c2 = fgetc(f);
-        if (ic_isxdigit(c1) && ic_isxdigit(c2)) {
-          char chr = from_xdigit(c1)*16 + from_xdigit(c2);
-          sbuf_append_char(sbuf,chr);
-        }
-        else return false;
-      }
-      else return false;
+  const char* end = s + len;
+  while (s < end) {
+    // copy everything up to the next escape at once
+    const char* esc = (const char*)memchr(s, '\\', to_size_t(end - s));
+    if (esc == NULL) esc = end;
+    if (esc > s) { sbuf_append_n(sbuf, s, esc - s); }
+    if (esc >= end) break;
+    s = esc + 1;
+    if (s >= end) return false;
+    char c = *s++;
+    if (c == 'n')       { sbuf_append(sbuf,"\n"); }
+    else if (c == 'r')  { /* ignore */ }  // sbuf_append(sbuf,"\r");
+    else if (c == 't')  { sbuf_append(sbuf,"\t"); }
+    else if (c == '\\') { sbuf_append(sbuf,"\\"); }
+    else if (c == 'x' && end - s >= 2 && ic_isxdigit(s[0]) && ic_isxdigit(s[1])) {
+      char chr = from_xdigit(s[0])*16 + from_xdigit(s[1]);
+      sbuf_append_char(sbuf,chr);
+      s += 2;
     }
-    else sbuf_append_char(sbuf,(char)c);
+    else return false;
   }
-  if (sbuf_len(sbuf)==0 || sbuf_string(sbuf)[0] == '#') return true;
-  return history_push(h, sbuf_string(sbuf));
+  return true;
 }
 
-static bool history_write_entry( const char* entry, FILE* f, stringbuf_t* sbuf ) {
-  sbuf_clear(sbuf);
+static void history_encode_entry( const char* entry, stringbuf_t* sbuf ) {
+  const ssize_t start = sbuf_len(sbuf);
   //debug_msg("history: write: %s\n", entry);
   while( entry != NULL && *entry != 0 ) {
     char c = *entry++;
@@ -229,41 +1336,609 @@ static bool history_write_entry( const char* entry, FILE* f, stringbuf_t* sbuf )
     else sbuf_append_char(sbuf,c);
   }
   //debug_msg("history: write buf: %s\n", sbuf_string(sbuf));
-  
-  if (sbuf_len(sbuf) > 0) {
+  if (sbuf_len(sbuf) > start) {
     sbuf_append(sbuf,"\n");
-    fputs(sbuf_string(sbuf),f);
   }
+}
+
+// Metadata is written on a comment line `#@ <time> <duration> <status> <uses>[ <cwd>]` that 
+// follows the entry (such that older versions ignore it). Later lines override earlier ones.
+static void history_encode_meta( const history_t* h, ssize_t seq, stringbuf_t* sbuf ) {
+  hmeta_t m;
+  history_meta_get(h, seq, &m);
+  if (hmeta_is_empty(&m)) return;
+  sbuf_appendf(sbuf, "#@ %lld %lu %d %lu", (long long)m.time, (unsigned long)m.duration, (int)m.status, (unsigned long)m.uses);
+  const char* cwd = history_cwd(h, m.cwd);
+  if (cwd != NULL) {
+    sbuf_append(sbuf, " ");
+    history_encode_entry(cwd, sbuf);
+  }
+  else {
+    sbuf_append(sbuf, "\n");
+  }
+}
+
+static bool history_parse_int( const char** p, const char* end, int64_t* v ) {
+  const char* s = *p;
+  bool neg = false;
+  if (s < end && *s == '-') { neg = true; s++; }
+  if (s >= end || *s < '0' || *s > '9') return false;
+  uint64_t x = 0;
+  while (s < end && *s >= '0' && *s <= '9') { x = 10*x + (uint64_t)(*s - '0'); s++; }
+  if (s < end && *s != ' ') return false;
+  *v = (neg ? -(int64_t)x : (int64_t)x);
+  *p = (s < end ? s + 1 : s);
   return true;
 }
 
+// parse a metadata line
+static bool history_decode_meta( history_t* h, const char* line, ssize_t len, hmeta_t* m, stringbuf_t* sbuf ) {
+  if (len < 3 || line[0] != '#' || line[1] != '@' || line[2] != ' ') return false;
+  const char* p = line + 3;
+  const char* end = line + len;
+  int64_t time, duration, status;
+  if (!history_parse_int(&p, end, &time) || !history_parse_int(&p, end, &duration) || 
+      !history_parse_int(&p, end, &status)) return false;
+  m->time = time;
+  m->duration = (duration <= 0 ? 0 : (duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration));
+  m->status = (int32_t)status;
+  int64_t uses = 0;  // not written by earlier versions
+  m->uses = (!history_parse_int(&p, end, &uses) || uses <= 0 ? 0 : (uses > UINT32_MAX ? UINT32_MAX : (uint32_t)uses));
+  m->cwd = 0;
+  if (p < end && history_decode_entry(p, end - p, sbuf)) {
+    m->cwd = history_cwd_intern(h, sbuf_string(sbuf), sbuf_len(sbuf));
+  }
+  return true;
+}
+
+static bool history_write_entry( const history_t* h, ssize_t seq, FILE* f, stringbuf_t* sbuf ) {
+  sbuf_clear(sbuf);
+  history_encode_entry(*history_slot(h,seq), sbuf);
+  history_encode_meta(h, seq, sbuf);
+  if (sbuf_len(sbuf) > 0) {
+    if (fputs(sbuf_string(sbuf),f) == EOF) return false;
+  }
+  return true;
+}
+
+// remember the state of the history file as we last read or wrote it
+static void history_file_stamp( history_t* h, const struct stat* st ) {
+  h->file_mtime = st->st_mtime;
+  h->file_ino = (uint64_t)st->st_ino;
+  h->file_dev = (uint64_t)st->st_dev;
+}
+
+// remember the file offset and the bytes before it; `end` points at that offset in memory
+static void history_file_mark( history_t* h, const char* end, ssize_t n, ssize_t offset ) {
+  if (n > IC_HISTORY_MARK) n = IC_HISTORY_MARK;
+  ic_memcpy(h->file_mark, end - n, n);
+  h->file_mark_len = n;
+  h->file_offset = offset;
+}
+
+// find the last occurrence of `c` in the first `n` bytes of `s` (scanning a word at a time)
+static const char* history_memrchr( const char* s, char c, ssize_t n ) {
+  const uintptr_t ones  = (~(uintptr_t)0) / 255;
+  const uintptr_t highs = ones * 0x80;
+  const uintptr_t pat   = ones * (uint8_t)c;
+  const char* p = s + n;
+  while (p - s >= ssizeof(uintptr_t)) {
+    uintptr_t w;
+    ic_memcpy(&w, p - sizeof(uintptr_t), ssizeof(uintptr_t));
+    w ^= pat;
+    if (((w - ones) & ~w & highs) != 0) break;  // contains `c`
+    p -= sizeof(uintptr_t);
+  }
+  while (p > s) {
+    p--;
+    if (*p == c) return p;
+  }
+  return NULL;
+}
+
+// map (or read) the whole file into memory
+static const char* history_map_file( history_t* h, const char* fname, ssize_t* size, bool* mapped, struct stat* st ) {
+  *size = 0;
+  *mapped = false;
+  memset(st, 0, sizeof(*st));
+  #ifndef _WIN32
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) return NULL;
+  if (fstat(fd, st) == 0 && S_ISREG(st->st_mode) && st->st_size > 0 && (uint64_t)st->st_size < (uint64_t)PTRDIFF_MAX) {
+    // no MAP_POPULATE: usually only the tail of the file is read
+    void* p = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      close(fd);
+      *size = (ssize_t)st->st_size;
+      *mapped = true;
+      return (const char*)p;
+    }
+  }
+  close(fd);
+  #endif
+  // otherwise read it in large blocks
+  FILE* f = fopen(fname, "rb");
+  if (f == NULL) return NULL;
+  if (fstat(fileno(f), st) != 0) { memset(st, 0, sizeof(*st)); }
+  ssize_t len = 0;
+  ssize_t cap = 0;
+  char* data = NULL;
+  while (true) {
+    if (cap - len < 64*1024) {
+      ssize_t newcap = (cap == 0 ? 256*1024 : 2*cap);
+      char* newdata = mem_realloc_tp(h->mem, char, data, newcap);
+      if (newdata == NULL) break;
+      data = newdata;
+      cap = newcap;
+    }
+    size_t n = fread(data + len, 1, to_size_t(cap - len), f);
+    if (n == 0) break;
+    len += (ssize_t)n;
+  }
+  fclose(f);
+  *size = len;
+  return data;
+}
+
+static void history_unmap_file( history_t* h, const char* data, ssize_t size, bool mapped ) {
+  if (data == NULL) return;
+  #ifndef _WIN32
+  if (mapped) { munmap((void*)data, to_size_t(size)); return; }
+  #else
+  ic_unused(mapped); ic_unused(size);
+  #endif
+  mem_free(h->mem, data);
+}
+
+// count the entries in the first `n` bytes of the history file `data`, scanning
+// backward from the end and stopping as soon as more than `max` are found
+static ssize_t history_count_lines( const char* data, ssize_t n, ssize_t max ) {
+  ssize_t count = 0;
+  ssize_t end = n;
+  while (end > 0 && count <= max) {
+    const ssize_t line_end = (data[end-1] == '\n' ? end - 1 : end);
+    const char* nl = history_memrchr(data, '\n', line_end);
+    const ssize_t start = (nl == NULL ? 0 : (nl - data) + 1);
+    const ssize_t len = line_end - start;
+    if (len > 0 && data[start] != '#' && !(len == 1 && data[start] == '\r')) count++;
+    end = start;
+  }
+  return count;
+}
+
+// Load the history file into an empty history. The file is read in one go
+// and its lines are decoded from the end such that only the latest copy of 
+// an entry is kept (and only the last `len` entries) without pushing and 
+// evicting entries. The kept entries are reversed afterwards.
 ic_private void history_load( history_t* h ) {
   if (h->fname == NULL) return;
-  FILE* f = fopen(h->fname, "r");
-  if (f == NULL) return;
+  assert(h->count == 0 && h->first == 0 && h->next == 0);
+  ssize_t size;
+  bool mapped;
+  struct stat st;
+  const char* data = history_map_file(h, h->fname, &size, &mapped, &st);
+  if (data == NULL) return;
+  history_file_stamp(h, &st);
+  history_file_mark(h, data + size, size, size);
+  // a lower bound suffices once it is large enough to trigger compaction on save
+  h->file_entries = history_count_lines(data, size, 2*h->len + IC_HISTORY_JOURNAL_SLACK);
+  bool loaded_meta = false;
   stringbuf_t* sbuf = sbuf_new(h->mem);
-  if (sbuf != NULL) {
-    while (!feof(f)) {
-      if (!history_read_entry(h,f,sbuf)) break; // error
+  if (sbuf != NULL && (h->allow_duplicates || 
+                       hindex_reserve(h, (h->file_entries < h->len ? h->file_entries : h->len)))) 
+  {
+    ssize_t end = size;  // end of the lines that remain to be read
+    hmeta_t meta;        // metadata that follows the next entry line
+    bool has_meta = false;
+    while (end > 0 && h->count < h->len) {
+      const ssize_t line_end = (data[end-1] == '\n' ? end - 1 : end);
+      const char* nl = history_memrchr(data, '\n', line_end);
+      const ssize_t start = (nl == NULL ? 0 : (nl - data) + 1);
+      end = start;
+      ssize_t len = line_end - start;
+      const char* line = data + start;
+      if (len > 0 && line[len-1] == '\r') len--;  // written in text mode
+      if (len == 0) continue;
+      if (line[0] == '#') {
+        // comment; the last metadata line after an entry holds its metadata
+        if (!has_meta) { has_meta = history_decode_meta(h, line, len, &meta, sbuf); }
+        continue;
+      }
+      const bool entry_has_meta = has_meta;
+      has_meta = false;
+      const char* entry = line;
+      ssize_t entry_len = len;
+      if (memchr(line, '\\', to_size_t(len)) != NULL || memchr(line, 0, to_size_t(len)) != NULL) {
+        // needs decoding
+        if (!history_decode_entry(line, len, sbuf)) continue;
+        entry = sbuf_string(sbuf);
+        entry_len = ic_strlen(entry);
+        if (entry_len == 0) continue;
+      }
+      uint32_t hash = 0;
+      if (!h->allow_duplicates) {
+        hash = ic_strnhash(entry, entry_len);
+        if (hindex_find(h, entry, entry_len, hash) >= 0) continue;  // a later copy is kept
+      }
+      if (!history_append(h, entry, entry_len)) break;
+      if (!h->allow_duplicates) {
+        hindex_insert(h, h->next - 1, hash);
+      }
+      if (entry_has_meta) { 
+        if (!history_meta_put(h, h->next - 1, &meta)) break;
+        loaded_meta = true;
+      }
     }
-    sbuf_free(sbuf);
   }
-  fclose(f);
+  sbuf_free(sbuf);
+  history_unmap_file(h, data, size, mapped);
+  // entries were appended newest first
+  for( ssize_t i = h->first, j = h->next - 1; i < j; i++, j--) {
+    const char** a = history_slot(h,i);
+    const char** b = history_slot(h,j);
+    const char* e = *a;
+    *a = *b;
+    *b = e;
+    if (loaded_meta) {
+      hmeta_t ma, mb;
+      history_meta_get(h, i, &ma);
+      history_meta_get(h, j, &mb);
+      if (!history_meta_put(h, i, &mb) || !history_meta_put(h, j, &ma)) { loaded_meta = false; }
+    }
+  }
+  for( ssize_t i = 0; i < h->index_len; i++) {
+    if (h->index[i].seq >= 0) { h->index[i].seq = h->first + h->next - 1 - h->index[i].seq; }
+  }
+  h->saved_next = h->next;
 }
 
-ic_private void history_save( const history_t* h ) {
-  if (h->fname == NULL) return;
+static void history_fsync( int fd ) {
+  #if defined(_WIN32)
+  _commit(fd);
+  #else
+  fsync(fd);
+  #endif
+}
+
+// Open the history file for appending. In shared mode, the file is locked
+// (waiting for other processes) and reopened if it was replaced in the mean time.
+static int history_open_append( history_t* h ) {
+  #if defined(_WIN32)
+  return _open(h->fname, _O_RDWR | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+  #else
+  for( int tries = 0; tries < 8; tries++) {
+    int fd = open(h->fname, O_RDWR | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0 || !h->shared) return fd;
+    // use `flock` as `fcntl` locks are released when any descriptor of the file is closed (as when reloading)
+    int res;
+    while ((res = flock(fd, LOCK_EX)) != 0 && errno == EINTR) { }
+    if (res != 0) { close(fd); return -1; }
+    struct stat st1;
+    struct stat st2;
+    if (fstat(fd, &st1) == 0 && stat(h->fname, &st2) == 0 && 
+        st1.st_ino == st2.st_ino && st1.st_dev == st2.st_dev) 
+    {
+      return fd;
+    }
+    close(fd);  // replaced while we were waiting for the lock
+  }
+  return -1;
+  #endif
+}
+
+static void history_close( int fd ) {
+  #if defined(_WIN32)
+  _close(fd);
+  #else
+  close(fd);  // also releases the lock
+  #endif
+}
+
+// read `len` bytes at `offset`
+static bool history_read_at( int fd, char* buf, ssize_t len, ssize_t offset ) {
+  #if defined(_WIN32)
+  if (_lseeki64(fd, offset, SEEK_SET) != offset) return false;
+  while (len > 0) {
+    int n = _read(fd, buf, (unsigned)(len > INT32_MAX ? INT32_MAX : len));
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+  }
+  #else
+  while (len > 0) {
+    ssize_t n = pread(fd, buf, to_size_t(len), (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  #endif
+  return true;
+}
+
+// remember the file offset and read the bytes before it from `fd`
+static void history_file_mark_fd( history_t* h, int fd, ssize_t offset ) {
+  char buf[IC_HISTORY_MARK];
+  ssize_t n = (offset < IC_HISTORY_MARK ? offset : IC_HISTORY_MARK);
+  if (!history_read_at(fd, buf, n, offset - n)) { n = 0; }
+  history_file_mark(h, buf + n, n, offset);
+}
+
+typedef struct hunsaved_s {
+  char*   entry;
+  hmeta_t meta;
+} hunsaved_t;
+
+// remove the entries that are not yet saved, and return copies of them (oldest first)
+static hunsaved_t* history_unsaved_take( history_t* h, ssize_t* count ) {
+  *count = 0;
+  const ssize_t from = (h->saved_next < h->first ? h->first : h->saved_next);
+  if (from >= h->next) return NULL;
+  hunsaved_t* entries = mem_malloc_tp_n(h->mem, hunsaved_t, h->next - from);
+  if (entries == NULL) return NULL;
+  for( ssize_t seq = from; seq < h->next; seq++) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL) continue;
+    entries[*count].entry = mem_strdup(h->mem, entry);
+    history_meta_get(h, seq, &entries[*count].meta);
+    if (entries[*count].entry != NULL) { (*count)++; }
+  }
+  for( ssize_t seq = h->next - 1; seq >= from; seq--) {
+    history_delete_seq(h, seq);
+  }
+  return entries;
+}
+
+// push the unsaved entries again after the entries read from the file
+static void history_unsaved_restore( history_t* h, hunsaved_t* entries, ssize_t count ) {
+  h->saved_next = h->next;
+  for( ssize_t i = 0; i < count; i++) {
+    if (history_push(h, entries[i].entry)) {
+      history_meta_put(h, h->next - 1, &entries[i].meta);
+    }
+    mem_free(h->mem, entries[i].entry);
+  }
+  mem_free(h->mem, entries);
+}
+
+// reload the whole history file but keep the entries that are not yet saved
+static void history_reload( history_t* h ) {
+  ssize_t count;
+  hunsaved_t* unsaved = history_unsaved_take(h, &count);
+  // and the metadata of the last saved entry if it was not saved yet
+  hunsaved_t pending = { NULL, { 0, 0, 0, 0, 0 } };
+  const ssize_t last = h->saved_next - 1;
+  if (h->meta_pending && last >= h->first && last < h->next && *history_slot(h,last) != NULL) {
+    pending.entry = mem_strdup(h->mem, *history_slot(h,last));
+    history_meta_get(h, last, &pending.meta);
+  }
+  history_clear(h);
+  history_forget_file(h);
+  history_load(h);
+  if (pending.entry != NULL) {
+    const ssize_t len = ic_strlen(pending.entry);
+    const ssize_t seq = (h->allow_duplicates ? -1 : hindex_find(h, pending.entry, len, ic_strnhash(pending.entry, len)));
+    if (seq >= 0) { history_meta_update(h, seq, &pending.meta); }
+    mem_free(h->mem, pending.entry);
+  }
+  history_unsaved_restore(h, unsaved, count);
+}
+
+// Read the lines that were appended to the file since we last read it.
+// Returns false if the bytes before our offset changed (i.e. the file was rewritten).
+static bool history_merge_tail( history_t* h, int fd, ssize_t size ) {
+  const ssize_t start = h->file_offset - h->file_mark_len;
+  const ssize_t len = size - start;
+  char* buf = mem_malloc_tp_n(h->mem, char, len);
+  if (buf == NULL) return true;
+  bool ok = (history_read_at(fd, buf, len, start) && 
+             memcmp(buf, h->file_mark, to_size_t(h->file_mark_len)) == 0);
+  stringbuf_t* sbuf = (ok ? sbuf_new(h->mem) : NULL);
+  const char* tail = buf + h->file_mark_len;
+  const char* nl = (sbuf == NULL ? NULL : history_memrchr(tail, '\n', size - h->file_offset));  // only complete lines
+  if (nl != NULL) {
+    ssize_t count;
+    hunsaved_t* unsaved = history_unsaved_take(h, &count);
+    const char* end = nl + 1;
+    ssize_t last = -1;  // sequence number of the last merged entry
+    const bool displaced = h->file_displaced;  // merged entries are on disk already
+    for( const char* line = tail; line < end; ) {
+      const char* eol = (const char*)memchr(line, '\n', to_size_t(end - line));
+      ssize_t n = eol - line;
+      if (n > 0 && line[n-1] == '\r') n--;
+      if (n > 0 && line[0] == '#') {
+        hmeta_t meta;
+        if (last >= 0 && history_decode_meta(h, line, n, &meta, sbuf)) { history_meta_put(h, last, &meta); }
+      }
+      else if (n > 0) {
+        h->file_entries++;
+        last = -1;
+        if (history_decode_entry(line, n, sbuf) && sbuf_len(sbuf) > 0 && history_push(h, sbuf_string(sbuf))) {
+          last = h->next - 1;
+        }
+      }
+      line = eol + 1;
+    }
+    h->file_tail_ours = false;
+    h->file_displaced = displaced;
+    history_unsaved_restore(h, unsaved, count);
+    history_file_mark(h, end, end - buf, h->file_offset + (end - tail));
+  }
+  sbuf_free(sbuf);
+  mem_free(h->mem, buf);
+  return ok;
+}
+
+// merge the entries that other processes appended to the history file,
+// or reload it completely if it was rewritten in the mean time.
+static void history_merge( history_t* h, int fd ) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) return;
+  const ssize_t size = (ssize_t)st.st_size;
+  const bool same = ((uint64_t)st.st_ino == h->file_ino && (uint64_t)st.st_dev == h->file_dev);
+  if (same && size == h->file_offset && st.st_mtime == h->file_mtime) return;  // unchanged
+  if (same && size > h->file_offset && history_merge_tail(h, fd, size)) {
+    history_file_stamp(h, &st);
+  }
+  else {
+    history_reload(h);
+  }
+}
+
+// Merge entries that other processes added to a shared history file.
+// Called before reading a new line; this is cheap if the file is unchanged.
+ic_private void history_sync( history_t* h ) {
+  if (!h->shared || h->fname == NULL || h->len <= 0) return;
+  struct stat st;
+  if (stat(h->fname, &st) != 0) return;
+  if ((uint64_t)st.st_ino == h->file_ino && (uint64_t)st.st_dev == h->file_dev && 
+      (ssize_t)st.st_size == h->file_offset && st.st_mtime == h->file_mtime) return;
+  #if defined(_WIN32)
+  int fd = _open(h->fname, _O_RDONLY | _O_BINARY);
+  #else
+  int fd = open(h->fname, O_RDONLY);
+  #endif
+  if (fd < 0) return;
+  history_merge(h, fd);
+  history_close(fd);
+}
+
+// write `data` with a single write
+static bool history_write_fd( int fd, const char* data, ssize_t len, bool sync ) {
+  #if defined(_WIN32)
+  bool ok = (_write(fd, data, (unsigned)len) == len);
+  #else
+  bool ok = (write(fd, data, to_size_t(len)) == len);
+  #endif
+  if (ok && sync) { history_fsync(fd); }
+  return ok;
+}
+
+#ifndef _WIN32
+// Create a fresh temporary file next to the (symlink resolved) history file that takes
+// over the mode and ownership of the original. Returns the temporary and the real name.
+static FILE* history_open_temp( history_t* h, stringbuf_t* tname, stringbuf_t* rname ) {
+  char* real = realpath(h->fname, NULL);
+  sbuf_append(rname, (real != NULL ? real : h->fname));  // the file may not exist yet
+  free(real);
+  sbuf_append(tname, sbuf_string(rname));
+  sbuf_append(tname, ".XXXXXX");
+  if (sbuf_len(rname) == 0 || sbuf_len(tname) != sbuf_len(rname) + 7) return NULL;  // out of memory
+  char* tmp = (char*)sbuf_string(tname);
+  int fd = mkstemp(tmp);  // mode 0600
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (stat(sbuf_string(rname), &st) == 0) {
+    if (fchown(fd, st.st_uid, st.st_gid) != 0) { /* keep our own ownership */ }
+    fchmod(fd, st.st_mode & 07777);
+  }
+  FILE* f = fdopen(fd, "w");
+  if (f == NULL) {
+    close(fd);
+    unlink(tmp);
+  }
+  return f;
+}
+#endif
+
+// rewrite the history file with all current entries
+static void history_save_all( history_t* h ) {
+  #ifndef _WIN32
+  // write to a temporary file first so a crash or a full disk never loses the history
+  stringbuf_t* tname = sbuf_new(h->mem);
+  stringbuf_t* rname = sbuf_new(h->mem);
+  FILE* f = (tname == NULL || rname == NULL ? NULL : history_open_temp(h, tname, rname));
+  #else
   FILE* f = fopen(h->fname, "w");
-  if (f == NULL) return;
+  #endif
+  if (f != NULL) {
+    stringbuf_t* sbuf = sbuf_new(h->mem);
+    bool ok = (sbuf != NULL);
+    for( ssize_t seq = h->first; ok && seq < h->next; seq++ )  {
+      if (*history_slot(h,seq) == NULL) continue;
+      ok = history_write_entry(h,seq,f,sbuf);
+    }
+    ok = ok && (fflush(f) == 0) && !ferror(f);
+    if (ok && h->journal_sync) { history_fsync(fileno(f)); }
+    // stat before renaming; after that other processes can append to it
+    struct stat st;
+    ok = ok && (fstat(fileno(f), &st) == 0);
+    ok = (fclose(f) == 0) && ok;
+    #ifndef _WIN32
+    ok = ok && (rename(sbuf_string(tname), sbuf_string(rname)) == 0);
+    if (!ok) { unlink(sbuf_string(tname)); }
+    #endif
+    if (ok) {
+      h->file_entries = h->count;
+      history_file_mark(h, sbuf_string(sbuf) + sbuf_len(sbuf), sbuf_len(sbuf), (ssize_t)st.st_size);  // the last entry
+      history_file_stamp(h, &st);
+      h->file_stale = false;
+      h->file_displaced = false;
+      h->file_tail_ours = true;
+      h->meta_pending = false;
+      h->saved_next = h->next;
+    }
+    sbuf_free(sbuf);
+  }
   #ifndef _WIN32
-  chmod(h->fname,S_IRUSR|S_IWUSR);
+  sbuf_free(rname);
+  sbuf_free(tname);
   #endif
+}
+
+// append the entries that were not yet saved with a single write
+static bool history_save_append( history_t* h, int fd ) {
+  if (h->saved_next >= h->next && !h->meta_pending) return true;
   stringbuf_t* sbuf = sbuf_new(h->mem);
-  if (sbuf != NULL) {
-    for( int i = 0; i < h->count; i++ )  {
-      if (!history_write_entry(h->elems[i],f,sbuf)) break;  // error
+  if (sbuf == NULL) return false;
+  const ssize_t last = h->saved_next - 1;
+  if (h->meta_pending && last >= h->first && last < h->next && *history_slot(h,last) != NULL) {
+    // metadata of the last saved entry (which is the last entry in the file)
+    assert(h->file_tail_ours);
+    history_encode_meta(h, last, sbuf);
+  }
+  ssize_t appended = 0;
+  for( ssize_t seq = (h->saved_next < h->first ? h->first : h->saved_next); seq < h->next; seq++ ) {
+    const char* entry = *history_slot(h,seq);
+    if (entry == NULL) continue;
+    history_encode_entry(entry, sbuf);
+    history_encode_meta(h, seq, sbuf);
+    appended++;
+  }
+  bool ok = history_write_fd(fd, sbuf_string(sbuf), sbuf_len(sbuf), h->journal_sync);
+  sbuf_free(sbuf);
+  if (ok) {
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      history_file_mark_fd(h, fd, (ssize_t)st.st_size);
+      history_file_stamp(h, &st);
     }
-    sbuf_free(sbuf);
+    h->file_entries += appended;
+    h->file_displaced = false;
+    h->file_tail_ours = (appended > 0 || h->file_tail_ours);
+    h->meta_pending = false;
+    h->saved_next = h->next;
+  }
+  return ok;
+}
+
+ic_private void history_save( history_t* h ) {
+  if (h->fname == NULL) return;
+  if (!h->journal && !h->shared) {
+    history_save_all(h);
+    return;
+  }
+  int fd = history_open_append(h);
+  if (fd < 0) return;
+  if (h->shared) {
+    history_merge(h, fd);  // first add what other processes appended
+  }
+  if (h->file_stale || (h->meta_pending && !h->file_tail_ours) ||
+      h->file_entries + (h->next - h->saved_next) > 2*h->count + IC_HISTORY_JOURNAL_SLACK ||
+      !history_save_append(h, fd)) 
+  {
+    history_save_all(h);   // compact (while holding the lock in shared mode)
   }
-  fclose(f);  
+  history_close(fd);
 }
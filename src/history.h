@@ -21,18 +21,28 @@ ic_private history_t* history_new(alloc_t* mem);
 ic_private void     history_free(history_t* h);
 ic_private void     history_clear(history_t* h);
 ic_private bool     history_enable_duplicates( history_t* h, bool enable );
+ic_private bool     history_enable_journal( history_t* h, bool enable );
+ic_private bool     history_enable_journal_sync( history_t* h, bool enable );
+ic_private bool     history_enable_shared( history_t* h, bool enable );
 ic_private ssize_t  history_count(const history_t* h);
 
 ic_private void     history_load_from(history_t* h, const char* fname, long max_entries);
 ic_private void     history_load( history_t* h );
-ic_private void     history_save( const history_t* h );
+ic_private void     history_save( history_t* h );
+ic_private void     history_sync( history_t* h );
 
 ic_private bool     history_push( history_t* h, const char* entry );
 ic_private bool     history_update( history_t* h, const char* entry );
 ic_private const char* history_get( const history_t* h, ssize_t n );
 ic_private void     history_remove_last(history_t* h);
-
-ic_private bool     history_search( const history_t* h, ssize_t from, const char* search, bool backward, ssize_t* hidx, ssize_t* hpos);
+ic_private bool     history_set_time( history_t* h, ssize_t n, int64_t time );
+ic_private bool     history_set_meta( history_t* h, ssize_t n, long duration, int status, const char* cwd );
+ic_private const char* history_get_meta( const history_t* h, ssize_t n, int64_t* time, long* duration, int* status, const char** cwd );
+
+ic_private bool     history_search( history_t* h, ssize_t from, const char* search, bool backward, ssize_t* hidx, ssize_t* hpos);
+ic_private bool     history_prefix_search( history_t* h, ssize_t from, const char* prefix, bool backward, ssize_t* hidx );
+ic_private bool     history_frecent_search( history_t* h, const char* prefix, ssize_t skip, ssize_t* hidx );
+ic_private ssize_t  history_fuzzy_search( history_t* h, const char* query, ssize_t* hidxs, ssize_t max );
 
 
 #endif // IC_HISTORY_H
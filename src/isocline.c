@@ -27,8 +27,10 @@
 #include "completers.c"
 #include "completions.c"
 #include "editline.c"
+#include "fuzzy.c"
 #include "highlight.c"
 #include "history.c"
+#include "screen.c"
 #include "stringbuf.c"
 #include "term.c"
 #include "tty.c"
@@ -228,6 +230,45 @@ ic_public bool ic_enable_history_duplicates(bool enable) {
   return history_enable_duplicates(env->history, enable);
 }
 
+ic_public bool ic_enable_history_journal(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  return history_enable_journal(env->history, enable);
+}
+
+ic_public bool ic_enable_history_sync(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  return history_enable_journal_sync(env->history, enable);
+}
+
+ic_public bool ic_enable_history_prefix(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  bool prev = env->history_prefix;
+  env->history_prefix = enable;
+  return prev;
+}
+
+ic_public bool ic_enable_history_hint(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  bool prev = env->history_hint;
+  env->history_hint = enable;
+  return prev;
+}
+
+ic_public bool ic_enable_history_shared(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  return history_enable_shared(env->history, enable);
+}
+
 ic_public void ic_set_history(const char *fname, long max_entries) {
   ic_env_t *env = ic_get_env();
   if (env == NULL)
@@ -249,6 +290,23 @@ ic_public void ic_history_add(const char *entry) {
   history_push(env->history, entry);
 }
 
+ic_public bool ic_history_set_meta(long duration_ms, int status,
+                                  const char *cwd) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  return history_set_meta(env->history, 0, duration_ms, status, cwd);
+}
+
+ic_public const char *ic_history_get_meta(long n, int64_t *time,
+                                          long *duration_ms, int *status,
+                                          const char **cwd) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return NULL;
+  return history_get_meta(env->history, n, time, duration_ms, status, cwd);
+}
+
 ic_public void ic_history_clear(void) {
   ic_env_t *env = ic_get_env();
   if (env == NULL)
@@ -283,6 +341,15 @@ ic_public bool ic_enable_multiline_indent(bool enable) {
   return !prev;
 }
 
+ic_public bool ic_enable_incremental_refresh(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  bool prev = env->no_incremental_refresh;
+  env->no_incremental_refresh = !enable;
+  return !prev;
+}
+
 ic_public bool ic_enable_hint(bool enable) {
   ic_env_t *env = ic_get_env();
   if (env == NULL)
@@ -301,6 +368,47 @@ ic_public long ic_set_hint_delay(long delay_ms) {
   return prev;
 }
 
+ic_public bool ic_enable_async_completion(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  bool prev = env->complete_async;
+  env->complete_async = enable;
+  return prev;
+}
+
+ic_public bool ic_enable_dircache(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  return dircache_enable(env->dircache, enable);
+}
+
+ic_public long ic_set_dircache_size(long max_dirs) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return 0;
+  return (long)dircache_set_max(env->dircache, max_dirs);
+}
+
+ic_public bool ic_enable_parallel_filename_completion(bool enable) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return false;
+  bool prev = env->complete_parallel;
+  env->complete_parallel = enable;
+  return prev;
+}
+
+ic_public long ic_set_completion_deadline(long deadline_ms) {
+  ic_env_t *env = ic_get_env();
+  if (env == NULL)
+    return 0;
+  long prev = env->complete_deadline;
+  env->complete_deadline = (deadline_ms < 0 ? 0 : deadline_ms);
+  return prev;
+}
+
 ic_public void ic_set_tty_esc_delay(long initial_delay_ms,
                                     long followup_delay_ms) {
   ic_env_t *env = ic_get_env();
@@ -608,6 +716,7 @@ static void ic_env_free(ic_env_t *env) {
   history_save(env->history);
   history_free(env->history);
   completions_free(env->completions);
+  dircache_free(env->dircache);
   bbcode_free(env->bbcode);
   term_free(env->term);
   tty_free(env->tty);
@@ -653,8 +762,10 @@ static ic_env_t *ic_env_create(ic_malloc_fun_t *_malloc,
   env->term = term_new(env->mem, env->tty, false, false, -1);
   env->history = history_new(env->mem);
   env->completions = completions_new(env->mem);
+  env->dircache = dircache_new(env->mem); // can return NULL
   env->bbcode = bbcode_new(env->mem, env->term);
   env->hint_delay = 400;
+  env->complete_deadline = 1000;
 
   if (env->tty == NULL || env->term == NULL || env->completions == NULL ||
       env->history == NULL || env->bbcode == NULL ||
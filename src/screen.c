@@ -0,0 +1,356 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "common.h"
+#include "stringbuf.h"
+#include "screen.h"
+
+//-------------------------------------------------------------
+// A frame is a list of rows of cells. Each cell is one column
+// (or two for a wide character) with its text and attribute;
+// zero-width characters are part of the preceding cell.
+//-------------------------------------------------------------
+
+typedef struct cell_s {
+  ssize_t  ofs;      // start of the text in the frame text
+  ssize_t  len;      // length of the text in bytes
+  ssize_t  width;    // column width
+  attr_t   attr;     // absolute text attributes
+} cell_t;
+
+typedef struct frame_s {
+  stringbuf_t*  text;       // text of all cells
+  cell_t*       cells;
+  ssize_t       count;
+  ssize_t       len;
+  ssize_t*      rows;       // index of the first cell of each row
+  ssize_t       row_count;
+  ssize_t       rows_len;
+  ssize_t       row_width;  // width of the last row
+  bool          overflow;   // is a row wider than the terminal? (then the terminal wraps it)
+} frame_t;
+
+struct screen_s {
+  alloc_t*  mem;
+  term_t*   term;
+  frame_t   frames[2];
+  frame_t*  cur;        // frame that is being built
+  frame_t*  prev;       // frame that is displayed
+  bool      valid;      // does the terminal show `prev`?
+  ssize_t   width;
+  ssize_t   height;
+  ssize_t   row;        // cursor row relative to the top row
+  ssize_t   col;        // cursor column (or -1 if unknown, after writing the last column)
+  ssize_t   extent;     // rows from the top that exist on the terminal (below that we need a newline)
+  attr_t    attr;       // attributes of the terminal outside our cells
+};
+
+
+static void frame_done( alloc_t* mem, frame_t* f ) {
+  sbuf_free(f->text);
+  mem_free(mem, f->cells);
+  mem_free(mem, f->rows);
+  memset(f, 0, sizeof(*f));
+}
+
+static void frame_clear( frame_t* f ) {
+  sbuf_clear(f->text);
+  f->count = 0;
+  f->row_count = 0;
+  f->overflow = false;
+}
+
+static bool frame_push_row( alloc_t* mem, frame_t* f ) {
+  if (f->row_count >= f->rows_len) {
+    ssize_t newlen = (f->rows_len <= 0 ? 16 : 2*f->rows_len);
+    ssize_t* newrows = mem_realloc_tp(mem, ssize_t, f->rows, newlen);
+    if (newrows == NULL) return false;
+    f->rows = newrows;
+    f->rows_len = newlen;
+  }
+  f->rows[f->row_count++] = f->count;
+  f->row_width = 0;
+  return true;
+}
+
+static cell_t* frame_push_cell( alloc_t* mem, frame_t* f ) {
+  if (f->count >= f->len) {
+    ssize_t newlen = (f->len <= 0 ? 256 : 2*f->len);
+    cell_t* newcells = mem_realloc_tp(mem, cell_t, f->cells, newlen);
+    if (newcells == NULL) return NULL;
+    f->cells = newcells;
+    f->len = newlen;
+  }
+  return &f->cells[f->count++];
+}
+
+static cell_t* frame_row( const frame_t* f, ssize_t row, ssize_t* count ) {
+  if (row < 0 || row >= f->row_count) { *count = 0; return NULL; }
+  const ssize_t start = f->rows[row];
+  const ssize_t end = (row + 1 < f->row_count ? f->rows[row+1] : f->count);
+  *count = end - start;
+  return f->cells + start;
+}
+
+static ssize_t cells_width( const cell_t* cells, ssize_t count ) {
+  ssize_t w = 0;
+  for (ssize_t i = 0; i < count; i++) { w += cells[i].width; }
+  return w;
+}
+
+static bool cell_is_eq( const frame_t* f1, const cell_t* c1, const frame_t* f2, const cell_t* c2 ) {
+  return (c1->len == c2->len && c1->width == c2->width && attr_is_eq(c1->attr, c2->attr) &&
+          memcmp(sbuf_string(f1->text) + c1->ofs, sbuf_string(f2->text) + c2->ofs, to_size_t(c1->len)) == 0);
+}
+
+
+//-------------------------------------------------------------
+// Build a frame
+//-------------------------------------------------------------
+
+ic_private screen_t* screen_new( alloc_t* mem, term_t* term ) {
+  screen_t* sc = mem_zalloc_tp(mem, screen_t);
+  if (sc == NULL) return NULL;
+  sc->mem  = mem;
+  sc->term = term;
+  sc->frames[0].text = sbuf_new(mem);
+  sc->frames[1].text = sbuf_new(mem);
+  if (sc->frames[0].text == NULL || sc->frames[1].text == NULL) {
+    screen_free(sc);
+    return NULL;
+  }
+  sc->cur  = &sc->frames[0];
+  sc->prev = &sc->frames[1];
+  return sc;
+}
+
+ic_private void screen_free( screen_t* sc ) {
+  if (sc == NULL) return;
+  frame_done(sc->mem, &sc->frames[0]);
+  frame_done(sc->mem, &sc->frames[1]);
+  mem_free(sc->mem, sc);
+}
+
+ic_private void screen_invalidate( screen_t* sc ) {
+  if (sc == NULL) return;
+  sc->valid = false;
+}
+
+ic_private void screen_begin( screen_t* sc, ssize_t width, ssize_t height ) {
+  if (width != sc->width || height != sc->height) {
+    sc->valid  = false;
+    sc->width  = width;
+    sc->height = height;
+  }
+  frame_clear(sc->cur);
+  if (!frame_push_row(sc->mem, sc->cur)) { sc->valid = false; }
+}
+
+ic_private void screen_newline( screen_t* sc ) {
+  if (!frame_push_row(sc->mem, sc->cur)) { sc->valid = false; }
+}
+
+// append `s` to the last row; each character has attribute `attr` updated with its `attrs` (if not NULL)
+ic_private void screen_append( screen_t* sc, const char* s, ssize_t len, const attr_t* attrs, attr_t attr ) {
+  frame_t* f = sc->cur;
+  if (f->row_count <= 0) return;
+  ssize_t i = 0;
+  while (i < len) {
+    ssize_t w;
+    const ssize_t n = str_next_ofs(s, len, i, &w);
+    if (n <= 0) break;
+    if (w < 0) w = 0;
+    if (w == 0 && f->count > f->rows[f->row_count-1]) {
+      // part of the previous cell
+      f->cells[f->count-1].len += n;
+    }
+    else {
+      cell_t* cell = frame_push_cell(sc->mem, f);
+      if (cell == NULL) { sc->valid = false; return; }
+      cell->ofs   = sbuf_len(f->text);
+      cell->len   = n;
+      cell->width = w;
+      cell->attr  = (attrs == NULL ? attr : attr_update_with(attr, attrs[i]));
+    }
+    sbuf_append_n(f->text, s + i, n);
+    f->row_width += w;
+    i += n;
+  }
+  if (sc->width > 0 && f->row_width > sc->width) { f->overflow = true; }
+}
+
+
+//-------------------------------------------------------------
+// Render the differences
+//-------------------------------------------------------------
+
+// move the cursor relative to its current position
+static void screen_move( screen_t* sc, ssize_t row, ssize_t col ) {
+  term_t* term = sc->term;
+  if (sc->col < 0) {
+    term_start_of_line(term);
+    sc->col = 0;
+  }
+  if (row < sc->row) {
+    term_up(term, sc->row - row);
+    sc->row = row;
+  }
+  else if (row > sc->row) {
+    // move down over existing rows, and use newlines for new rows (which may scroll the terminal)
+    const ssize_t down = (row < sc->extent ? row : sc->extent - 1) - sc->row;
+    if (down > 0) {
+      term_down(term, down);
+      sc->row += down;
+    }
+    if (sc->row < row) {
+      term_set_attr(term, sc->attr);
+      while (sc->row < row) {
+        term_write(term, "\n");
+        sc->row++;
+        sc->col = 0;
+      }
+    }
+    if (row >= sc->extent) { sc->extent = row + 1; }
+  }
+  if (col != sc->col) {
+    if (col == 0) term_start_of_line(term);
+    else if (col < sc->col) term_left(term, sc->col - col);
+    else term_right(term, col - sc->col);
+    sc->col = (sc->width > 0 && col >= sc->width ? -1 : col);  // the terminal stops at the last column
+  }
+}
+
+static void screen_write_cells( screen_t* sc, const cell_t* cells, ssize_t count ) {
+  const char* text = sbuf_string(sc->cur->text);
+  ssize_t i = 0;
+  while (i < count) {
+    // write cells with the same attributes at once
+    ssize_t n = 1;
+    ssize_t w = cells[i].width;
+    while (i + n < count && attr_is_eq(cells[i+n].attr, cells[i].attr)) {
+      w += cells[i+n].width;
+      n++;
+    }
+    term_set_attr(sc->term, cells[i].attr);
+    term_write_n(sc->term, text + cells[i].ofs, cells[i+n-1].ofs + cells[i+n-1].len - cells[i].ofs);
+    if (sc->col >= 0) { sc->col += w; }
+    i += n;
+  }
+  // in the last column the cursor position depends on the terminal
+  if (sc->width > 0 && sc->col >= sc->width) { sc->col = -1; }
+}
+
+static void screen_clear_to_end_of_line( screen_t* sc ) {
+  if (sc->col < 0) return;  // nothing left
+  term_set_attr(sc->term, sc->attr);
+  term_clear_to_end_of_line(sc->term);
+}
+
+// write a row where the terminal contents are unknown
+static void screen_render_row_full( screen_t* sc, ssize_t row ) {
+  ssize_t count;
+  const cell_t* cells = frame_row(sc->cur, row, &count);
+  screen_move(sc, row, 0);
+  screen_write_cells(sc, cells, count);
+  screen_clear_to_end_of_line(sc);
+}
+
+// write only the cells of a row that differ from the previous frame
+static void screen_render_row( screen_t* sc, ssize_t row ) {
+  ssize_t ncount, ocount;
+  const cell_t* ncells = frame_row(sc->cur, row, &ncount);
+  const cell_t* ocells = frame_row(sc->prev, row, &ocount);
+
+  // skip the common prefix
+  ssize_t i = 0;
+  ssize_t col = 0;
+  while (i < ncount && i < ocount && cell_is_eq(sc->cur, &ncells[i], sc->prev, &ocells[i])) {
+    col += ncells[i].width;
+    i++;
+  }
+  if (i == ncount && i == ocount) return;
+
+  // and the common suffix if the rows have the same width
+  const ssize_t nwidth = cells_width(ncells, ncount);
+  const ssize_t owidth = cells_width(ocells, ocount);
+  ssize_t nend = ncount;
+  ssize_t oend = ocount;
+  if (nwidth == owidth) {
+    while (nend > i && oend > i && cell_is_eq(sc->cur, &ncells[nend-1], sc->prev, &ocells[oend-1])) {
+      nend--;
+      oend--;
+    }
+  }
+
+  // write the changed cells, but move over longer runs of cells that are unchanged in the same column
+  screen_move(sc, row, col);
+  ssize_t j = i;
+  ssize_t oj = i;
+  ssize_t ocol = col;
+  while (j < nend) {
+    while (oj < ocount && ocol < col) {
+      ocol += ocells[oj].width;
+      oj++;
+    }
+    // the run of unchanged cells at `j` (equal cells have equal widths so the columns stay aligned)
+    ssize_t k = j;
+    ssize_t kcol = col;
+    if (ocol == col) {
+      while (k < nend && oj + (k - j) < ocount && cell_is_eq(sc->cur, &ncells[k], sc->prev, &ocells[oj + (k - j)])) {
+        kcol += ncells[k].width;
+        k++;
+      }
+    }
+    if (k > j && (k == nend || kcol - col > 4)) {
+      // cheaper to move the cursor than to rewrite
+      if (k < nend) { screen_move(sc, row, kcol); }
+    }
+    else {
+      if (k == j) { k = j + 1; }
+      screen_write_cells(sc, ncells + j, k - j);
+      kcol = col + cells_width(ncells + j, k - j);
+    }
+    j = k;
+    col = kcol;
+  }
+  if (nwidth < owidth) {
+    screen_move(sc, row, nwidth);
+    screen_clear_to_end_of_line(sc);
+  }
+}
+
+ic_private void screen_render( screen_t* sc, ssize_t row, ssize_t col, ssize_t prev_row, ssize_t prev_rows ) {
+  term_t* term = sc->term;
+  sc->attr = term_get_attr(term);
+  const ssize_t rows = sc->cur->row_count;
+  if (!sc->valid || sc->cur->overflow) {
+    // back up to the top and write every row
+    term_start_of_line(term);
+    term_up(term, prev_row);
+    sc->row = 0;
+    sc->col = 0;
+    sc->extent = (prev_rows > 1 ? prev_rows : 1);
+    for (ssize_t r = 0; r < rows || r < prev_rows; r++) {
+      screen_render_row_full(sc, r);
+    }
+  }
+  else {
+    const ssize_t prows = sc->prev->row_count;
+    for (ssize_t r = 0; r < rows || r < prows; r++) {
+      screen_render_row(sc, r);
+    }
+  }
+  screen_move(sc, row, col);
+  term_set_attr(term, sc->attr);
+
+  // the new frame is now displayed
+  frame_t* f = sc->prev;
+  sc->prev = sc->cur;
+  sc->cur = f;
+  sc->valid = !sc->prev->overflow;  // we cannot track rows wrapped by the terminal
+}
@@ -0,0 +1,40 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef IC_SCREEN_H
+#define IC_SCREEN_H
+
+#include "common.h"
+#include "term.h"
+#include "attr.h"
+
+//-------------------------------------------------------------
+// Screen model: the rows displayed by the editor as a grid of
+// cells. A new frame is built on each refresh and only the cells
+// that differ from the previous frame are written to the terminal.
+//-------------------------------------------------------------
+
+struct screen_s;
+typedef struct screen_s screen_t;
+
+ic_private screen_t* screen_new( alloc_t* mem, term_t* term );
+ic_private void      screen_free( screen_t* sc );  // sc can be NULL
+
+// The terminal no longer shows the previous frame (after a resize, or other output)
+ic_private void      screen_invalidate( screen_t* sc );
+
+// Build a new frame row by row
+ic_private void      screen_begin( screen_t* sc, ssize_t width, ssize_t height );
+ic_private void      screen_append( screen_t* sc, const char* s, ssize_t len, const attr_t* attrs, attr_t attr );
+ic_private void      screen_newline( screen_t* sc );
+
+// Write the differences with the previous frame and put the cursor at `row`,`col` of the new frame.
+// If the previous frame is invalid, all rows are written: the cursor is assumed at row `prev_row`,
+// and the `prev_rows` rows from the top are overwritten.
+ic_private void      screen_render( screen_t* sc, ssize_t row, ssize_t col, ssize_t prev_row, ssize_t prev_rows );
+
+#endif // IC_SCREEN_H
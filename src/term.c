@@ -266,12 +266,6 @@ ic_private void term_beep(term_t* term) {
   fflush(stderr);
 }
 
-ic_private void term_write_repeat(term_t* term, const char* s, ssize_t count) {
-  for (; count > 0; count--) {
-    term_write(term, s);
-  }
-}
-
 ic_private void term_write(term_t* term, const char* s) {
   if (s == NULL || s[0] == 0) return;
   ssize_t n = ic_strlen(s);
@@ -41,7 +41,6 @@ ic_private void term_write(term_t* term, const char* s);
 ic_private void term_writeln(term_t* term, const char* s);
 ic_private void term_write_char(term_t* term, char c);
 
-ic_private void term_write_repeat(term_t* term, const char* s, ssize_t count );
 ic_private void term_beep(term_t* term);
 
 ic_private bool term_update_dim(term_t* term);
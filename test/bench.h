@@ -0,0 +1,22 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Helpers shared by the benchmarks.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef IC_BENCH_H
+#define IC_BENCH_H
+
+#include <time.h>
+
+// monotonic time in milliseconds
+static double now_msecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1.0e6);
+}
+
+#endif // IC_BENCH_H
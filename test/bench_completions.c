@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Benchmark the allocation traffic of generating many completions,
+  the time to sort them for the completion menu, and the throughput 
+  of adding them one by one versus in a batch.
+  This includes the sources directly to call the completion engine without
+  a terminal; run it with `zig build c-bench-completions`.
+-----------------------------------------------------------------------------*/
+#include "../src/isocline.c"
+#include "bench.h"
+
+static long mallocs = 0;
+static long frees   = 0;
+
+static void* count_malloc(size_t size) {
+  mallocs++;
+  return malloc(size);
+}
+
+static void* count_realloc(void* p, size_t size) {
+  if (p == NULL) mallocs++;
+  return realloc(p, size);
+}
+
+static void count_free(void* p) {
+  if (p != NULL) frees++;
+  free(p);
+}
+
+static long completion_count = 0;
+
+static void symbol_completer(ic_completion_env_t* cenv, const char* prefix) {
+  char replacement[64];
+  char display[80];
+  char help[64];
+  for (long i = 0; i < completion_count; i++) {
+    snprintf(replacement, sizeof(replacement), "%ssymbol_%ld", prefix, i);
+    snprintf(display, sizeof(display), "[b]symbol_%ld[/b]", i);
+    snprintf(help, sizeof(help), "module %ld", i % 97);
+    if (!ic_add_completion_ex(cenv, replacement, display, help)) return;
+  }
+}
+
+// pre-formatted completions such that only the insertion is measured
+static ic_completion_t* batch_items = NULL;
+static long batch_count = 0;
+
+static void item_completer(ic_completion_env_t* cenv, const char* prefix) {
+  ic_unused(prefix);
+  for (long i = 0; i < batch_count; i++) {
+    if (!ic_add_completion_ex(cenv, batch_items[i].replacement, batch_items[i].display, batch_items[i].help)) return;
+  }
+}
+
+static void batch_completer(ic_completion_env_t* cenv, const char* prefix) {
+  ic_unused(prefix);
+  ic_add_completions_n(cenv, batch_items, batch_count);
+}
+
+static void bench_batch(ic_env_t* env) {
+  const long counts[] = { 1000, 10000, 100000 };
+  const long rounds = 20;
+  printf("\n%12s %18s %18s %18s %18s\n", "completions", "per item (us)", "batch (us)", 
+         "per item (M/s)", "batch (M/s)");
+  for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+    batch_count = counts[i];
+    batch_items = (ic_completion_t*)calloc((size_t)batch_count, sizeof(ic_completion_t));
+    if (batch_items == NULL) return;
+    for (long j = 0; j < batch_count; j++) {
+      char buf[80];
+      snprintf(buf, sizeof(buf), "symbol_%ld", j);
+      batch_items[j].replacement = strdup(buf);
+      snprintf(buf, sizeof(buf), "[b]symbol_%ld[/b]", j);
+      batch_items[j].display = strdup(buf);
+      snprintf(buf, sizeof(buf), "module %ld", j % 97);
+      batch_items[j].help = strdup(buf);
+    }
+    double msecs[2] = { 0, 0 };
+    for (int b = 0; b < 2; b++) {
+      completions_set_completer(env->completions, (b == 0 ? &item_completer : &batch_completer), NULL);
+      for (long r = 0; r < rounds; r++) {
+        completions_clear(env->completions);
+        const double start = now_msecs();
+        completions_generate(env, env->completions, "", 0, batch_count);
+        msecs[b] += now_msecs() - start;
+      }
+      if (completions_count(env->completions) != batch_count) { printf("error: missing completions\n"); }
+    }
+    printf("%12ld %18.1f %18.1f %18.2f %18.2f\n", batch_count, 
+           msecs[0] * 1000.0 / (double)rounds, msecs[1] * 1000.0 / (double)rounds,
+           (double)batch_count * (double)rounds / (msecs[0] * 1000.0), 
+           (double)batch_count * (double)rounds / (msecs[1] * 1000.0));
+    for (long j = 0; j < batch_count; j++) {
+      free((void*)batch_items[j].replacement);
+      free((void*)batch_items[j].display);
+      free((void*)batch_items[j].help);
+    }
+    free(batch_items);
+  }
+}
+
+int main()
+{
+  const long counts[] = { 1000, 10000 };
+  const long rounds = 100;  // like pressing tab or refreshing a hint repeatedly
+  ic_env_t* env = ic_env_create(&count_malloc, &count_realloc, &count_free);
+  if (env == NULL) return 1;
+  completions_set_completer(env->completions, &symbol_completer, NULL);
+  printf("%12s %14s %14s %18s %18s %14s\n", "completions", "first mallocs", "first frees",
+         "mallocs (/round)", "frees (/round)", "time (us)");
+  for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+    completion_count = counts[i];
+    completions_clear(env->completions);
+    long m0 = mallocs, f0 = frees;
+    completions_generate(env, env->completions, "", 0, completion_count);
+    const long first_mallocs = mallocs - m0;
+    const long first_frees = frees - f0;
+    m0 = mallocs; f0 = frees;
+    const double start = now_msecs();
+    for (long r = 0; r < rounds; r++) {
+      completions_generate(env, env->completions, "", 0, completion_count);
+    }
+    const double usecs = (now_msecs() - start) * 1000.0 / (double)rounds;
+    printf("%12ld %14ld %14ld %18.1f %18.1f %14.1f\n", completion_count, first_mallocs, first_frees,
+           (double)(mallocs - m0) / (double)rounds, (double)(frees - f0) / (double)rounds, usecs);
+  }
+
+  // sorting for the menu: only the first page is needed at first
+  printf("\n%12s %18s %18s\n", "completions", "first page (us)", "all (us)");
+  for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+    completion_count = counts[i];
+    double page_msecs = 0;
+    double all_msecs = 0;
+    for (long r = 0; r < rounds; r++) {
+      completions_clear(env->completions);
+      completions_generate(env, env->completions, "", 0, completion_count);
+      double start = now_msecs();
+      completions_sort(env->completions, 9);
+      page_msecs += now_msecs() - start;
+      start = now_msecs();
+      completions_sort(env->completions, completion_count);
+      all_msecs += now_msecs() - start;
+    }
+    printf("%12ld %18.1f %18.1f\n", completion_count, page_msecs * 1000.0 / (double)rounds, 
+           (page_msecs + all_msecs) * 1000.0 / (double)rounds);
+  }
+  bench_batch(env);
+  ic_env_free(env);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Benchmark ranking many candidates with `ic_add_completions_fuzzy`.
+  This includes the sources directly to call the completion engine without
+  a terminal; run it with `zig build c-bench-fuzzy -Doptimize=ReleaseFast`.
+-----------------------------------------------------------------------------*/
+#include "../src/isocline.c"
+#include "bench.h"
+
+#define CANDIDATES  (100000)
+
+static const char* candidates[CANDIDATES+1];
+static const char* query = NULL;
+
+static void fuzzy_completer(ic_completion_env_t* cenv, const char* prefix) {
+  ic_add_completions_fuzzy(cenv, prefix, candidates);
+}
+
+int main()
+{
+  // identifiers like `get_buffer_size42` and `setWindowTitle7`
+  static const char* words[] = { "get", "set", "buffer", "window", "size", "title", "read", "write",
+                                 "file", "path", "stream", "history", "complete", "token", "parse", "line" };
+  const size_t nwords = sizeof(words)/sizeof(words[0]);
+  uint32_t rnd = 42;
+  char buf[128];
+  for (long i = 0; i < CANDIDATES; i++) {
+    size_t n = 0;
+    const int parts = 2 + (int)((rnd = rnd*1664525 + 1013904223) >> 30);
+    for (int p = 0; p < parts; p++) {
+      const char* w = words[((rnd = rnd*1664525 + 1013904223) >> 16) % nwords];
+      const bool camel = (i % 2 == 0);
+      if (p > 0 && !camel) buf[n++] = '_';
+      for (size_t k = 0; w[k] != 0; k++) {
+        buf[n++] = (p > 0 && k == 0 && camel ? (char)(w[k] - 'a' + 'A') : w[k]);
+      }
+    }
+    snprintf(buf + n, sizeof(buf) - n, "%ld", i % 100);
+    candidates[i] = strdup(buf);
+  }
+  candidates[CANDIDATES] = NULL;
+
+  ic_env_t* env = ic_env_create(NULL, NULL, NULL);
+  if (env == NULL) return 1;
+  completions_set_completer(env->completions, &fuzzy_completer, NULL);
+  const char* queries[] = { "gbs", "wintit", "hist", "parseline", "x" };
+  const long rounds = 20;
+  printf("%12s %10s %14s  %s\n", "query", "matches", "time (us)", "best");
+  for (size_t q = 0; q < sizeof(queries)/sizeof(queries[0]); q++) {
+    query = queries[q];
+    ssize_t count = 0;
+    const double start = now_msecs();
+    for (long r = 0; r < rounds; r++) {
+      count = completions_generate(env, env->completions, query, ic_strlen(query), IC_MAX_COMPLETIONS_TO_TRY);
+    }
+    const double usecs = (now_msecs() - start) * 1000.0 / (double)rounds;
+    const char* best = completions_get_display(env->completions, 0, NULL);
+    printf("%12s %10zd %14.1f  %s\n", query, count, usecs, (best == NULL ? "" : best));
+  }
+  ic_env_free(env);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Benchmark loading and appending to large histories.
+-----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "isocline.h"
+#include "bench.h"
+
+static const char* fname = "bench_history.txt";
+
+static long peak_rss_kib(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  #if defined(__APPLE__)
+  return (long)(ru.ru_maxrss / 1024);  // in bytes on macOS
+  #else
+  return (long)ru.ru_maxrss;
+  #endif
+}
+
+static void write_history(long entries) {
+  FILE* f = fopen(fname, "w");
+  if (f == NULL) { perror(fname); exit(1); }
+  for (long i = 0; i < entries; i++) {
+    fprintf(f, "git commit -m \"fix issue %ld\" src/module%ld/file%ld.c\n", i, i % 97, i % 1013);
+  }
+  fclose(f);
+}
+
+int main()
+{
+  const long sizes[] = { 10000, 100000, 1000000 };
+  const long appends = 10000;
+  printf("%10s %12s %16s %16s %16s\n", "entries", "load (ms)", "load 200 (ms)", "append (ns/op)", "peak rss (KiB)");
+  for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    const long n = sizes[i];
+    write_history(n);
+
+    double start = now_msecs();
+    ic_set_history(fname, 200);  // only the most recent entries
+    const double load_recent = now_msecs() - start;
+
+    start = now_msecs();
+    ic_set_history(fname, n);
+    const double load = now_msecs() - start;
+
+    char entry[128];
+    start = now_msecs();
+    for (long j = 0; j < appends; j++) {
+      snprintf(entry, sizeof(entry), "make -j8 target%ld", j % 512);  // mostly duplicates
+      ic_history_add(entry);
+    }
+    const double append = (now_msecs() - start) * 1.0e6 / (double)appends;
+    printf("%10ld %12.1f %16.1f %16.1f %16ld\n", n, load, load_recent, append, peak_rss_kib());
+  }
+  ic_set_history(NULL, -1);  // do not save at exit
+  remove(fname);
+  return 0;
+}
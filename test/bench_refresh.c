@@ -0,0 +1,446 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Benchmark the bytes written to the terminal by the refreshes of some
+  typical edit sessions, redrawing all rows versus only the changed cells.
+  The output of both modes is replayed on a small terminal emulator and
+  the screens must be the same after every step of a session.
+  This includes the sources directly to drive the editor without
+  a terminal; run it with `zig build c-bench-refresh`.
+-----------------------------------------------------------------------------*/
+#include "../src/isocline.c"
+#include <stdio.h>
+
+typedef enum op_e {
+  TYPE,       // type the text
+  NEWLINE,    // insert a new line
+  LEFT,       // move the cursor left `n` times
+  UP,         // move the cursor up `n` rows
+  BACKSPACE,  // delete `n` characters before the cursor
+  END,        // end of the session
+} op_t;
+
+typedef struct step_s {
+  op_t        op;
+  const char* text;
+  long        n;
+} step_t;
+
+typedef struct session_s {
+  const char*   name;
+  const step_t* steps;
+} session_t;
+
+static const step_t command[] = {
+  { TYPE, "git commit --amend -m \"fix the refresh of long lines\"", 0 },
+  { END, NULL, 0 }
+};
+
+static const step_t edit_line_middle[] = {
+  { TYPE, "static int count = 42; // the number of times we refreshed the screen", 0 },
+  { LEFT, NULL, 50 },
+  { TYPE, "const ", 0 },
+  { BACKSPACE, NULL, 6 },
+  { LEFT, NULL, 10 },
+  { TYPE, "unsigned ", 0 },
+  { END, NULL, 0 }
+};
+
+static const step_t multi_line[] = {
+  { TYPE, "static int fib(int n) {", 0 }, { NEWLINE, NULL, 0 },
+  { TYPE, "  if (n <= 1) return n;", 0 }, { NEWLINE, NULL, 0 },
+  { TYPE, "  int a = 0, b = 1;", 0 },     { NEWLINE, NULL, 0 },
+  { TYPE, "  for (int i = 1; i < n; i++) { int c = a + b; a = b; b = c; }", 0 }, { NEWLINE, NULL, 0 },
+  { TYPE, "  return b;", 0 },             { NEWLINE, NULL, 0 },
+  { TYPE, "}", 0 },
+  { UP, NULL, 3 },
+  { TYPE, " // iterate", 0 },
+  { END, NULL, 0 }
+};
+
+static const step_t wrapped_line[] = {
+  { TYPE, "echo the quick brown fox jumps over the lazy dog and then the quick brown fox "
+          "jumps over the lazy dog again and again until the line wraps around the terminal "
+          "a couple of times 1 2 3 4 5 6 7 8 9 10", 0 },
+  { LEFT, NULL, 120 },
+  { TYPE, "very ", 0 },
+  { END, NULL, 0 }
+};
+
+static const step_t shrinking[] = {
+  { TYPE, "ls -la /usr/local/share/applications /usr/share/applications ~/.local/share/applications "
+          "| grep -v desktop | sort -k5 -n | tail -n 20 | awk '{ print $5, $9 }' > sizes.txt", 0 },
+  { LEFT, NULL, 30 },
+  { BACKSPACE, NULL, 90 },
+  { TYPE, "x", 0 },
+  { NEWLINE, NULL, 0 },
+  { TYPE, "cat sizes.txt", 0 },
+  { UP, NULL, 1 },
+  { BACKSPACE, NULL, 40 },
+  { END, NULL, 0 }
+};
+
+static const session_t sessions[] = {
+  { "command", command },
+  { "edit middle", edit_line_middle },
+  { "multi-line", multi_line },
+  { "wrapped", wrapped_line },
+  { "shrinking", shrinking },
+  { NULL, NULL }
+};
+
+static void highlighter(ic_highlight_env_t* henv, const char* input, void* arg) {
+  ic_unused(arg);
+  long len = (long)strlen(input);
+  for (long i = 0; i < len; ) {
+    static const char* keywords[] = { "static", "const", "unsigned", "return", "if", "for", NULL };
+    static const char* types[] = { "int", "char", "void", NULL };
+    long tlen;
+    if ((tlen = ic_match_any_token(input, i, &ic_char_is_idletter, keywords)) > 0) {
+      ic_highlight(henv, i, tlen, "keyword");
+    }
+    else if ((tlen = ic_match_any_token(input, i, &ic_char_is_idletter, types)) > 0) {
+      ic_highlight(henv, i, tlen, "type");
+    }
+    else if ((tlen = ic_is_token(input, i, &ic_char_is_digit)) > 0) {
+      ic_highlight(henv, i, tlen, "number");
+    }
+    else {
+      tlen = 1;
+      ic_highlight(henv, i, 1, NULL);
+    }
+    i += tlen;
+  }
+}
+
+//-------------------------------------------------------------
+// A minimal terminal emulator for the escape sequences that are
+// used to refresh the input: CR, LF, cursor movement (CUU, CUD,
+// CUF, CUB), erasing (EL, ED) and text attributes (SGR).
+// Like xterm, writing in the last column defers the wrap until
+// the next character is written. A line feed also returns to the
+// first column as the tty translates it to CR LF (`ONLCR`).
+//-------------------------------------------------------------
+
+#define VT_WIDTH   (80)
+#define VT_HEIGHT  (25)
+#define VT_CELL    (8)     // bytes of a (utf-8) character
+
+typedef struct vt_attr_s {
+  long fg;                 // -1 for the default, 0-255 palette, or 0x1000000 + rgb
+  long bg;
+  bool bold, italic, underline, reverse;
+} vt_attr_t;
+
+typedef struct vt_cell_s {
+  char      text[VT_CELL];
+  vt_attr_t attr;
+} vt_cell_t;
+
+typedef struct vt_s {
+  vt_cell_t cells[VT_HEIGHT][VT_WIDTH];
+  long      row;
+  long      col;
+  bool      wrap_pending;  // was the last column written?
+  vt_attr_t attr;
+} vt_t;
+
+static void vt_attr_reset(vt_attr_t* a) {
+  memset(a, 0, sizeof(*a));
+  a->fg = -1;
+  a->bg = -1;
+}
+
+static bool vt_attr_eq(const vt_attr_t* a, const vt_attr_t* b) {
+  return (a->fg == b->fg && a->bg == b->bg && a->bold == b->bold && a->italic == b->italic &&
+          a->underline == b->underline && a->reverse == b->reverse);
+}
+
+static void vt_erase(vt_t* vt, long row, long from, long to) {
+  for (long c = from; c < to; c++) {
+    vt_cell_t* cell = &vt->cells[row][c];
+    memset(cell, 0, sizeof(*cell));
+    vt_attr_reset(&cell->attr);
+    cell->attr.bg = vt->attr.bg;  // erasing uses the current background
+  }
+}
+
+static void vt_init(vt_t* vt) {
+  memset(vt, 0, sizeof(*vt));
+  vt_attr_reset(&vt->attr);
+  for (long r = 0; r < VT_HEIGHT; r++) { vt_erase(vt, r, 0, VT_WIDTH); }
+}
+
+static void vt_linefeed(vt_t* vt) {
+  vt->wrap_pending = false;
+  if (vt->row < VT_HEIGHT - 1) { vt->row++; return; }
+  memmove(&vt->cells[0], &vt->cells[1], (VT_HEIGHT - 1) * sizeof(vt->cells[0]));  // scroll up
+  vt_erase(vt, VT_HEIGHT - 1, 0, VT_WIDTH);
+}
+
+static void vt_put(vt_t* vt, const char* s, long len) {
+  if (vt->wrap_pending) {
+    vt->col = 0;
+    vt_linefeed(vt);
+  }
+  vt_cell_t* cell = &vt->cells[vt->row][vt->col];
+  memset(cell->text, 0, VT_CELL);
+  memcpy(cell->text, s, (size_t)(len < VT_CELL ? len : VT_CELL - 1));
+  cell->attr = vt->attr;
+  if (vt->col < VT_WIDTH - 1) { vt->col++; }
+                         else { vt->wrap_pending = true; }
+}
+
+// parse an extended color (`38;5;n` or `38;2;r;g;b`) starting at `params[*i]`
+static long vt_ext_color(const long* params, long n, long* i) {
+  if (*i + 2 < n && params[*i + 1] == 5) {
+    *i += 2;
+    return params[*i];
+  }
+  if (*i + 4 < n && params[*i + 1] == 2) {
+    long rgb = (params[*i + 2] << 16) | (params[*i + 3] << 8) | params[*i + 4];
+    *i += 4;
+    return 0x1000000 + rgb;
+  }
+  return -1;
+}
+
+static void vt_sgr(vt_t* vt, const long* params, long n) {
+  if (n == 0) { vt_attr_reset(&vt->attr); return; }
+  vt_attr_t* a = &vt->attr;
+  for (long i = 0; i < n; i++) {
+    long p = params[i];
+    if (p == 0) vt_attr_reset(a);
+    else if (p == 1) a->bold = true;
+    else if (p == 22) a->bold = false;
+    else if (p == 3) a->italic = true;
+    else if (p == 23) a->italic = false;
+    else if (p == 4) a->underline = true;
+    else if (p == 24) a->underline = false;
+    else if (p == 7) a->reverse = true;
+    else if (p == 27) a->reverse = false;
+    else if (p >= 30 && p <= 37) a->fg = p - 30;
+    else if (p >= 90 && p <= 97) a->fg = p - 90 + 8;
+    else if (p == 38) a->fg = vt_ext_color(params, n, &i);
+    else if (p == 39) a->fg = -1;
+    else if (p >= 40 && p <= 47) a->bg = p - 40;
+    else if (p >= 100 && p <= 107) a->bg = p - 100 + 8;
+    else if (p == 48) a->bg = vt_ext_color(params, n, &i);
+    else if (p == 49) a->bg = -1;
+  }
+}
+
+static void vt_csi(vt_t* vt, char final, const long* params, long n, bool private_mode) {
+  if (private_mode) return;  // like showing or hiding the cursor
+  const long arg = (n > 0 && params[0] > 0 ? params[0] : 1);
+  switch (final) {
+    case 'A': vt->row -= arg; if (vt->row < 0) vt->row = 0; break;
+    case 'B': vt->row += arg; if (vt->row >= VT_HEIGHT) vt->row = VT_HEIGHT - 1; break;
+    case 'C': vt->col += arg; if (vt->col >= VT_WIDTH) vt->col = VT_WIDTH - 1; break;
+    case 'D': vt->col -= arg; if (vt->col < 0) vt->col = 0; break;
+    case 'K': vt_erase(vt, vt->row, vt->col, VT_WIDTH); break;
+    case 'J': {
+      vt_erase(vt, vt->row, vt->col, VT_WIDTH);
+      for (long r = vt->row + 1; r < VT_HEIGHT; r++) { vt_erase(vt, r, 0, VT_WIDTH); }
+      break;
+    }
+    case 'm': vt_sgr(vt, params, n); return;  // keeps a pending wrap
+    default:
+      fprintf(stderr, "vt: unsupported escape sequence ESC[%c\n", final);
+      exit(1);
+  }
+  vt->wrap_pending = false;
+}
+
+static void vt_write(vt_t* vt, const char* s, long len) {
+  for (long i = 0; i < len; ) {
+    const char c = s[i];
+    if (c == '\r') { vt->col = 0; vt->wrap_pending = false; i++; }
+    else if (c == '\n') { vt->col = 0; vt_linefeed(vt); i++; }
+    else if (c == '\x1B' && i + 1 < len && s[i+1] == '[') {
+      long params[16];
+      long n = 0;
+      bool private_mode = false;
+      i += 2;
+      if (i < len && s[i] == '?') { private_mode = true; i++; }
+      while (i < len && ((s[i] >= '0' && s[i] <= '9') || s[i] == ';')) {
+        long v = 0;
+        while (i < len && s[i] >= '0' && s[i] <= '9') { v = 10*v + (s[i] - '0'); i++; }
+        if (n < 16) { params[n++] = v; }
+        if (i < len && s[i] == ';') i++;
+      }
+      if (i < len) { vt_csi(vt, s[i], params, n, private_mode); i++; }
+    }
+    else if ((uint8_t)c < ' ') { i++; }  // ignore other control characters
+    else {
+      long n = 1;
+      while (i + n < len && ((uint8_t)s[i + n] & 0xC0) == 0x80) { n++; }  // utf-8 continuation
+      vt_put(vt, s + i, n);
+      i += n;
+    }
+  }
+}
+
+// compare two screens; print the first differing row if they differ
+static bool vt_equal(const vt_t* vt1, const vt_t* vt2) {
+  bool eq = true;
+  for (long r = 0; eq && r < VT_HEIGHT; r++) {
+    for (long c = 0; c < VT_WIDTH; c++) {
+      const vt_cell_t* c1 = &vt1->cells[r][c];
+      const vt_cell_t* c2 = &vt2->cells[r][c];
+      if (strcmp(c1->text, c2->text) != 0 || !vt_attr_eq(&c1->attr, &c2->attr)) {
+        fprintf(stderr, "  screens differ at row %ld, column %ld\n", r, c);
+        eq = false;
+        break;
+      }
+    }
+  }
+  if (eq && (vt1->row != vt2->row || vt1->col != vt2->col)) {
+    fprintf(stderr, "  cursors differ: (%ld,%ld) vs. (%ld,%ld)\n", vt1->row, vt1->col, vt2->row, vt2->col);
+    eq = false;
+  }
+  return eq;
+}
+
+
+//-------------------------------------------------------------
+// Run the sessions
+//-------------------------------------------------------------
+
+#define MAX_STEPS  (64)
+
+typedef struct output_s {
+  char*  text;                 // all bytes written
+  long   len;
+  long   marks[MAX_STEPS+1];   // length of the output after each step
+  long   mark_count;
+} output_t;
+
+static long output_offset(ic_env_t* env) {
+  term_flush(env->term);
+  return (long)lseek(env->term->fd_out, 0, SEEK_CUR);
+}
+
+// run a session like `edit_line` would and record the output
+static void run_session(ic_env_t* env, const session_t* session, output_t* out) {
+  editor_t eb;
+  memset(&eb, 0, sizeof(eb));
+  eb.mem       = env->mem;
+  eb.input     = sbuf_new(env->mem);
+  eb.extra     = sbuf_new(env->mem);
+  eb.hint      = sbuf_new(env->mem);
+  eb.hint_help = sbuf_new(env->mem);
+  eb.termw     = term_get_width(env->term);
+  eb.cur_rows  = 1;
+  eb.prompt_text  = "bench";
+  eb.prompt    = sbuf_new(env->mem);
+  eb.attrs_prompt = attrbuf_new(env->mem);
+  eb.attrs     = attrbuf_new(env->mem);
+  eb.attrs_extra = attrbuf_new(env->mem);
+  eb.screen    = screen_new(env->mem, env->term);
+  editstate_init(&eb.undo);
+  editstate_init(&eb.redo);
+
+  const long start = output_offset(env);
+  out->mark_count = 0;
+  edit_refresh(env, &eb);
+  out->marks[out->mark_count++] = output_offset(env) - start;
+  for (const step_t* step = session->steps; step->op != END; step++) {
+    switch (step->op) {
+      case TYPE:
+        for (const char* s = step->text; *s != 0; s++) { edit_insert_char(env, &eb, *s); }
+        break;
+      case NEWLINE:   edit_insert_char(env, &eb, '\n'); break;
+      case LEFT:      for (long i = 0; i < step->n; i++) { edit_cursor_left(env, &eb); } break;
+      case UP:        for (long i = 0; i < step->n; i++) { edit_cursor_row_up(env, &eb); } break;
+      case BACKSPACE: for (long i = 0; i < step->n; i++) { edit_backspace(env, &eb); } break;
+      default: break;
+    }
+    if (out->mark_count < MAX_STEPS) { out->marks[out->mark_count++] = output_offset(env) - start; }
+  }
+  // accept the input
+  eb.pos = sbuf_len(eb.input);
+  edit_refresh(env, &eb);
+  const long end = output_offset(env);
+  out->marks[out->mark_count++] = end - start;
+  out->len = end - start;
+  out->text = (char*)malloc((size_t)(out->len > 0 ? out->len : 1));
+  if (out->text == NULL || pread(env->term->fd_out, out->text, (size_t)out->len, (off_t)start) != out->len) {
+    fprintf(stderr, "cannot read back the output\n");
+    exit(1);
+  }
+
+  editstate_done(env->mem, &eb.undo);
+  editstate_done(env->mem, &eb.redo);
+  screen_free(eb.screen);
+  attrbuf_free(eb.attrs);
+  attrbuf_free(eb.attrs_extra);
+  attrbuf_free(eb.attrs_prompt);
+  sbuf_free(eb.prompt);
+  sbuf_free(eb.input);
+  sbuf_free(eb.extra);
+  sbuf_free(eb.hint);
+  sbuf_free(eb.hint_help);
+}
+
+// replay the output of both modes and check the screens are the same after each step
+static bool check_session(const session_t* session, const output_t* redraw, const output_t* changed) {
+  if (redraw->mark_count != changed->mark_count) return false;
+  static vt_t vt1, vt2;
+  vt_init(&vt1);
+  vt_init(&vt2);
+  for (long i = 0; i < redraw->mark_count; i++) {
+    const long from1 = (i == 0 ? 0 : redraw->marks[i-1]);
+    const long from2 = (i == 0 ? 0 : changed->marks[i-1]);
+    vt_write(&vt1, redraw->text + from1, redraw->marks[i] - from1);
+    vt_write(&vt2, changed->text + from2, changed->marks[i] - from2);
+    if (!vt_equal(&vt1, &vt2)) {
+      fprintf(stderr, "  session \"%s\": the screens differ after step %ld\n", session->name, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  ic_env_t* env = ic_get_env();
+  if (env == NULL) return 1;
+  FILE* out = tmpfile();
+  if (out == NULL) return 1;
+  // write to a file as if it were an 80x25 color terminal
+  env->term->fd_out  = fileno(out);
+  env->term->nocolor = false;
+  env->term->width   = VT_WIDTH;
+  env->term->height  = VT_HEIGHT;
+  env->no_hint = true;
+  ic_set_default_highlighter(&highlighter, NULL);
+
+  printf("%14s %16s %16s %10s\n", "session", "redraw (bytes)", "changed (bytes)", "ratio");
+  long totals[2] = { 0, 0 };
+  bool ok = true;
+  for (const session_t* session = sessions; session->name != NULL; session++) {
+    output_t outputs[2];
+    for (int incremental = 0; incremental < 2; incremental++) {
+      ic_enable_incremental_refresh(incremental != 0);
+      run_session(env, session, &outputs[incremental]);
+      totals[incremental] += outputs[incremental].len;
+    }
+    const long redraw = outputs[0].len;
+    const long changed = outputs[1].len;
+    printf("%14s %16ld %16ld %9.1fx\n", session->name, redraw, changed, (double)redraw / (double)changed);
+    if (!check_session(session, &outputs[0], &outputs[1])) { ok = false; }
+    free(outputs[0].text);
+    free(outputs[1].text);
+  }
+  printf("%14s %16ld %16ld %9.1fx\n", "total", totals[0], totals[1], (double)totals[0] / (double)totals[1]);
+  fclose(out);
+  if (!ok) {
+    fprintf(stderr, "error: the incremental refresh shows a different screen than a full redraw\n");
+    return 1;
+  }
+  return 0;
+}